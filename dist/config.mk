@@ -2,9 +2,15 @@ SOURCES+=src/level.cpp
 SOURCES+=src/color.cpp
 SOURCES+=src/blocks.cpp
 SOURCES+=src/world.cpp
+SOURCES+=src/level_index.cpp
 SOURCES+=src/text.cpp
 SOURCES+=src/players.cpp
+SOURCES+=src/region.cpp
+SOURCES+=src/async_reader.cpp
 SOURCES+=src/fileutils.cpp
+SOURCES+=src/world_index.cpp
+SOURCES+=src/canvas.cpp
+SOURCES+=src/watcher.cpp
 SOURCES+=src/image.cpp
 SOURCES+=src/common.cpp
 SOURCES+=src/nbt/nbt.cpp
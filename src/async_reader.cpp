@@ -0,0 +1,384 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#include "async_reader.h"
+
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/stat.h>
+#endif
+
+#if defined(C10T_HAVE_FIEMAP)
+#  include <sys/ioctl.h>
+#  include <linux/fs.h>
+#  include <linux/fiemap.h>
+#endif
+
+#if defined(C10T_HAVE_IO_URING)
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+
+/*
+ * there is no libc wrapper for these, and liburing would only be used for
+ * the few lines of ring handling below
+ */
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params* p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void* arg, unsigned int nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * if the kernel behind the ring knows the operation. Kernels from before the
+ * probe (5.6) don't know plain reads either.
+ */
+static bool supports_op(int fd, unsigned int op) {
+  const unsigned int count = 256;
+  uint64_t request[(sizeof(struct io_uring_probe) + count * sizeof(struct io_uring_probe_op)) / sizeof(uint64_t) + 1];
+  memset(request, 0, sizeof(request));
+
+  struct io_uring_probe* probe = reinterpret_cast<struct io_uring_probe*>(request);
+
+  if (sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, count) == -1) {
+    return false;
+  }
+
+  return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+async_reader::async_reader(unsigned int depth)
+  : fd(-1), depth(depth),
+    sq_ring(MAP_FAILED), cq_ring(MAP_FAILED), sqes(MAP_FAILED),
+    sq_ring_size(0), cq_ring_size(0), sqes_size(0),
+    error(NULL)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  fd = sys_io_uring_setup(depth, &p);
+
+  if (fd == -1) {
+    error = strerror(errno);
+    return;
+  }
+
+  if (!supports_op(fd, IORING_OP_READ)) {
+    error = "io_uring can't read files on this kernel";
+    release();
+    return;
+  }
+
+  sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  // both rings may be in the one mapping
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  }
+
+  sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+  if (sq_ring != MAP_FAILED) {
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      cq_ring = sq_ring;
+    }
+    else {
+      cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+  }
+
+  if (cq_ring != MAP_FAILED) {
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  }
+
+  if (sqes == MAP_FAILED) {
+    error = strerror(errno);
+    release();
+    return;
+  }
+
+  uint8_t* sq = reinterpret_cast<uint8_t*>(sq_ring);
+  uint8_t* cq = reinterpret_cast<uint8_t*>(cq_ring);
+
+  sq_head = reinterpret_cast<unsigned int*>(sq + p.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+  sq_mask = reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+  sq_array = reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+  cq_head = reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+  cq_mask = reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+  cqes = cq + p.cq_off.cqes;
+}
+
+async_reader::~async_reader() {
+  release();
+}
+
+void async_reader::release() {
+  // whatever is still in flight is cancelled with the ring
+  for (std::map<size_t, pending_read>::iterator it = reads.begin(); it != reads.end(); it++) {
+    close(it->second.fd);
+  }
+
+  reads.clear();
+
+  if (sqes != MAP_FAILED) {
+    munmap(sqes, sqes_size);
+    sqes = MAP_FAILED;
+  }
+
+  if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+    munmap(cq_ring, cq_ring_size);
+  }
+
+  cq_ring = MAP_FAILED;
+
+  if (sq_ring != MAP_FAILED) {
+    munmap(sq_ring, sq_ring_size);
+    sq_ring = MAP_FAILED;
+  }
+
+  if (fd != -1) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+bool async_reader::queue(size_t id, pending_read& r) {
+  // only this thread ever moves the tail
+  unsigned int tail = *sq_tail;
+  unsigned int index = tail & *sq_mask;
+
+  struct io_uring_sqe* sqe = reinterpret_cast<struct io_uring_sqe*>(sqes) + index;
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = r.fd;
+  sqe->addr = reinterpret_cast<uintptr_t>(r.out->data + r.done);
+  sqe->len = r.size - r.done;
+  sqe->off = r.offset + r.done;
+  sqe->user_data = id;
+
+  sq_array[index] = index;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  int submitted;
+
+  do {
+    submitted = sys_io_uring_enter(fd, 1, 0, 0);
+  } while (submitted == -1 && errno == EINTR);
+
+  if (submitted != 1) {
+    // the kernel never looked at it
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    return false;
+  }
+
+  return true;
+}
+
+const char* async_reader::submit(size_t id, const char* path, nbt::buffer& out, size_t offset, size_t length) {
+  if (fd == -1) {
+    return error;
+  }
+
+  pending_read r;
+
+  r.fd = open(path, O_RDONLY);
+
+  if (r.fd == -1) {
+    return strerror(errno);
+  }
+
+  r.out = &out;
+  r.offset = offset;
+  r.size = length;
+  r.done = 0;
+
+  if (length == NPOS) {
+    struct stat st;
+
+    if (fstat(r.fd, &st) == -1) {
+      close(r.fd);
+      return strerror(errno);
+    }
+
+    r.size = size_t(st.st_size) > offset ? st.st_size - offset : 0;
+  }
+
+  out.size = 0;
+
+  if (!out.reserve(r.size + 1)) {
+    close(r.fd);
+    return "Failed to allocate read buffer";
+  }
+
+  pending_read& queued = reads[id] = r;
+
+  if (!queue(id, queued)) {
+    close(r.fd);
+    reads.erase(id);
+    return "Failed to queue read";
+  }
+
+  return NULL;
+}
+
+bool async_reader::complete(size_t& id, const char*& why) {
+  while (!reads.empty()) {
+    unsigned int head = *cq_head;
+
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+      if (sys_io_uring_enter(fd, 0, 1, IORING_ENTER_GETEVENTS) == -1
+          && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        error = strerror(errno);
+        return false;
+      }
+
+      continue;
+    }
+
+    struct io_uring_cqe* cqe = reinterpret_cast<struct io_uring_cqe*>(cqes) + (head & *cq_mask);
+
+    id = cqe->user_data;
+    int res = cqe->res;
+
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+
+    std::map<size_t, pending_read>::iterator it = reads.find(id);
+
+    if (it == reads.end()) {
+      continue;
+    }
+
+    pending_read& r = it->second;
+    why = NULL;
+
+    if (res < 0) {
+      why = strerror(-res);
+    }
+    else {
+      r.done += res;
+      r.out->size = r.done;
+
+      // a short read, the rest of the file is read again
+      if (res > 0 && r.done < r.size) {
+        if (queue(id, r)) {
+          continue;
+        }
+
+        why = "Failed to queue read";
+      }
+    }
+
+    close(r.fd);
+    reads.erase(it);
+    return true;
+  }
+
+  return false;
+}
+#else
+async_reader::async_reader(unsigned int depth) : fd(-1), depth(depth), error(NULL) {
+  error = "c10t was built without io_uring support";
+}
+
+async_reader::~async_reader() {
+}
+
+void async_reader::release() {
+}
+
+bool async_reader::queue(size_t id, pending_read& r) {
+  return false;
+}
+
+const char* async_reader::submit(size_t id, const char* path, nbt::buffer& out, size_t offset, size_t length) {
+  return error;
+}
+
+bool async_reader::complete(size_t& id, const char*& why) {
+  return false;
+}
+#endif
+
+bool advise_will_need(const char* path) {
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+  int file = open(path, O_RDONLY);
+
+  if (file == -1) {
+    return false;
+  }
+
+  // the kernel keeps reading ahead after the file is closed
+  int result = posix_fadvise(file, 0, 0, POSIX_FADV_WILLNEED);
+  close(file);
+  return result == 0;
+#else
+  return false;
+#endif
+}
+
+bool disk_position(const char* path, size_t offset, bool extent, uint64_t& major, uint64_t& minor) {
+#if !defined(_WIN32)
+  int file = open(path, O_RDONLY);
+
+  if (file == -1) {
+    return false;
+  }
+
+  bool found = false;
+
+  if (!extent) {
+    struct stat st;
+
+    if (fstat(file, &st) == 0) {
+      major = st.st_ino;
+      minor = offset;
+      found = true;
+    }
+  }
+#  if defined(C10T_HAVE_FIEMAP)
+  else {
+    // room for the one extent holding the offset
+    uint64_t request[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(uint64_t) + 1];
+    memset(request, 0, sizeof(request));
+
+    struct fiemap* map = reinterpret_cast<struct fiemap*>(request);
+    map->fm_start = offset;
+    map->fm_length = 1;
+    map->fm_extent_count = 1;
+
+    if (ioctl(file, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents == 1) {
+      struct fiemap_extent& e = map->fm_extents[0];
+
+      // not yet written out, or kept with the metadata, so nowhere to seek to
+      if (!(e.fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_DATA_INLINE))) {
+        major = e.fe_physical + (offset - e.fe_logical);
+        minor = 0;
+        found = true;
+      }
+    }
+  }
+#  endif
+
+  close(file);
+  return found;
+#else
+  return false;
+#endif
+}
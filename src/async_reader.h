@@ -0,0 +1,103 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#ifndef _ASYNC_READER_H_
+#define _ASYNC_READER_H_
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include <map>
+
+#include "nbt/nbt.h"
+
+/**
+ * Reads whole files with up to a number of reads in flight at once, through
+ * io_uring, all from the one thread calling it.
+ *
+ * Only available with a kernel (and headers) that have io_uring, elsewhere
+ * the reader never opens.
+ */
+class async_reader {
+private:
+  struct pending_read {
+    int fd;
+    nbt::buffer* out;
+    // where in the file to read, how much and how much of it has been read
+    size_t offset;
+    size_t size;
+    size_t done;
+  };
+  
+  int fd;
+  unsigned int depth;
+  // reads in flight by their id
+  std::map<size_t, pending_read> reads;
+  
+  // the rings shared with the kernel
+  void *sq_ring, *cq_ring, *sqes;
+  size_t sq_ring_size, cq_ring_size, sqes_size;
+  unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned int *cq_head, *cq_tail, *cq_mask;
+  void *cqes;
+  
+  async_reader(const async_reader&);
+  async_reader& operator=(const async_reader&);
+  
+  // queue a read of the rest of the file, false if the kernel refused it
+  bool queue(size_t id, pending_read& r);
+  void release();
+public:
+  static const size_t NPOS = size_t(-1);
+  
+  // set when the reader could not be opened
+  const char* error;
+  
+  async_reader(unsigned int depth);
+  ~async_reader();
+  
+  bool is_open() const {
+    return fd != -1;
+  }
+  
+  size_t in_flight() const {
+    return reads.size();
+  }
+  
+  bool is_full() const {
+    return reads.size() >= depth;
+  }
+  
+  /**
+   * Start reading `length' bytes at `offset' of the file at `path' into
+   * `out', or the rest of the file if length is NPOS, as read `id'.
+   *
+   * Returns NULL if the read was started, or a description of the error.
+   */
+  const char* submit(size_t id, const char* path, nbt::buffer& out, size_t offset = 0, size_t length = NPOS);
+  
+  /**
+   * Wait for a read to finish, its id is put in `id'.
+   *
+   * Returns false if there are none in flight or the ring failed (`error'
+   * is set then, and the reads in flight are lost). Otherwise `why' is set
+   * to a description of the error if the read failed, or NULL.
+   */
+  bool complete(size_t& id, const char*& why);
+};
+
+/*
+ * let the kernel know the file at path is about to be read, so that it can
+ * start reading it in. False if that isn't possible.
+ */
+bool advise_will_need(const char* path);
+
+/*
+ * where on the disk byte `offset' of the file at path is, as a key to sort
+ * reads by so that they sweep over the disk. The inode of the file and the
+ * offset, or with extent set the physical address of the byte, as far as
+ * the file system tells through FIEMAP. False if that isn't possible.
+ */
+bool disk_position(const char* path, size_t offset, bool extent, uint64_t& major, uint64_t& minor);
+
+#endif /* _ASYNC_READER_H_ */
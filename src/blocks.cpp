@@ -2,10 +2,6 @@
 // (C) Copyright 2010 John-John Tedro et al.
 #include "blocks.h"
 
-const int mc::MapX = 0x10;
-const int mc::MapZ = 0x10;
-const int mc::MapY = 0x80;
-
 const char **mc::MaterialName;
 color *mc::MaterialColor;
 color *mc::MaterialSideColor;
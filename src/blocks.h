@@ -111,9 +111,26 @@ namespace mc {
   void initialize_constants();
   void deinitialize_constants();
   
-  extern const int MapY;
-  extern const int MapX;
-  extern const int MapZ;
+  /**
+   * The dimensions of a chunk, known at compile time so that the index math
+   * of the render kernels folds into constant strides.
+   */
+  template<int X, int Y, int Z>
+  struct chunk_geometry {
+    static const int MapX = X;
+    static const int MapY = Y;
+    static const int MapZ = Z;
+  };
+  
+  // Alpha and McRegion chunks
+  typedef chunk_geometry<0x10, 0x80, 0x10> alpha_geometry;
+  // Anvil chunks
+  typedef chunk_geometry<0x10, 0x100, 0x10> anvil_geometry;
+  
+  // every geometry shares the width of a chunk
+  const int MapX = alpha_geometry::MapX;
+  const int MapZ = alpha_geometry::MapZ;
+  
   extern const char **MaterialName;
   extern color* MaterialColor;
   extern color* MaterialSideColor;
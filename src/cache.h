@@ -4,9 +4,10 @@
 #include <fstream>
 #include <ctime>
 #include <boost/filesystem.hpp>
-#include <zlib.h>
+#include <string.h>
 
 #include "image.h"
+#include "nbt/nbt.h"
 
 namespace fs = boost::filesystem;
 
@@ -23,47 +24,26 @@ private:
   std::time_t modification_time;
   typedef std::vector<image_operation>::size_type v_size_type;
 
-  inline bool gzwriteall(gzFile fp, char* bytes, size_t size) {
-    size_t size_o = 0;
-    
-    while (size_o < size) {
-      size_t size_w = gzwrite(fp, bytes + size_o, size - size_o);
-      if (size_w <= 0) return false;
-      size_o += size_w;
-    }
-    
-    return true;
-  }
-
-  inline bool gzreadall(gzFile fp, char* bytes, size_t size) {
-    size_t size_o = 0;
-    
-    while (size_o < size) {
-      size_t size_w = gzread(fp, bytes + size_o, size - size_o);
-      if (size_w <= 0) return false;
-      size_o += size_w;
-    }
-    
-    return true;
-  }
-  
+  /*
+   * the compressed format is the same as the plain one, but the whole file is
+   * (de)compressed in one go through the nbt inflate backend.
+   */
   bool write_z(image_operations* operations) {
-    gzFile fp = gzopen(path.string().c_str(), "wb");
+    v_size_type size = operations->operations.size();
     
-    if (fp == Z_NULL) {
-      return false;
-    }
+    nbt::buffer& buf = nbt::thread_buffer();
     
-    if (!gzwriteall(fp, reinterpret_cast<char *>(&modification_time), sizeof(std::time_t))) {
-      gzclose(fp);
+    if (!buf.reserve(sizeof(std::time_t) + sizeof(v_size_type) + sizeof(imop_file) * size)) {
       return false;
     }
     
-    v_size_type size = operations->operations.size();
-    if (!gzwriteall(fp, reinterpret_cast<char *>(&size), sizeof(v_size_type))) {
-      gzclose(fp);
-      return false;
-    }
+    uint8_t* p = buf.data;
+    
+    memcpy(p, &modification_time, sizeof(std::time_t));
+    p += sizeof(std::time_t);
+    
+    memcpy(p, &size, sizeof(v_size_type));
+    p += sizeof(v_size_type);
     
     for (
       std::vector<image_operation>::iterator it = operations->operations.begin();
@@ -73,55 +53,57 @@ private:
       iof.x = oper.x;
       iof.y = oper.y;
       iof.c = oper.c;
-      if (!gzwriteall(fp, reinterpret_cast<char*>(&iof), sizeof(imop_file))) {
-        gzclose(fp);
-        return false;
-      }
+      memcpy(p, &iof, sizeof(imop_file));
+      p += sizeof(imop_file);
     }
     
-    gzclose(fp);
-    return true;
+    buf.size = p - buf.data;
+    return nbt::deflate_file(path.string().c_str(), buf.data, buf.size) == NULL;
   }
   
   bool read_z(image_operations* operations, std::time_t mod) {
-    gzFile fp = gzopen(path.string().c_str(), "rb");
+    nbt::buffer& buf = nbt::thread_buffer();
     
-    if (!gzreadall(fp, reinterpret_cast<char*>(&modification_time), sizeof(std::time_t))) {
-      gzclose(fp);
+    if (nbt::inflate_file(path.string().c_str(), buf) != NULL) {
       return false;
     }
     
-    if (modification_time != mod) {
-      gzclose(fp);
+    const uint8_t* p = buf.data;
+    const uint8_t* end = buf.data + buf.size;
+    
+    if (size_t(end - p) < sizeof(std::time_t) + sizeof(v_size_type)) {
       return false;
     }
     
-    v_size_type size;
-    if (!gzreadall(fp, reinterpret_cast<char*>(&size), sizeof(v_size_type)))
-    {
-      gzclose(fp);
+    memcpy(&modification_time, p, sizeof(std::time_t));
+    p += sizeof(std::time_t);
+    
+    if (modification_time != mod) {
       return false;
     }
     
-    imop_file* oper = new imop_file[size];
+    v_size_type size;
+    memcpy(&size, p, sizeof(v_size_type));
+    p += sizeof(v_size_type);
     
-    if (!gzreadall(fp, reinterpret_cast<char*>(oper), sizeof(imop_file) * size)) {
-      gzclose(fp);
-      delete [] oper;
+    if (size_t(end - p) / sizeof(imop_file) < size) {
       return false;
     }
-
-    for (v_size_type i = 0; i < size; i++) {
-      imop_file iof = oper[i];
+    
+    operations->operations.reserve(operations->operations.size() + size);
+    
+    for (v_size_type i = 0; i < size; i++, p += sizeof(imop_file)) {
+      imop_file iof;
+      memcpy(static_cast<void*>(&iof), p, sizeof(imop_file));
       image_operation operation;
       operation.x = iof.x;
       operation.y = iof.y;
       operation.c = iof.c;
+      // operations are stored in the order they were added
+      operation.depth = operations->operations.size();
       operations->operations.push_back(operation);
     }
     
-    delete [] oper;
-    gzclose(fp);
     return true;
   }
 public:
@@ -166,6 +148,8 @@ public:
       operation.x = iof.x;
       operation.y = iof.y;
       operation.c = iof.c;
+      // operations are stored in the order they were added
+      operation.depth = operations->operations.size();
       operations->operations.push_back(operation);
     }
     
@@ -0,0 +1,162 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#include "canvas.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+// bumped whenever the layout below changes
+static const char chunks_magic[8] = {'c', '1', '0', 't', 'c', 'v', 's', '1'};
+
+/*
+ * stored in native byte order, like the cache files.
+ */
+template<typename T>
+static void put(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+static bool get(const char*& p, const char* end, T& value) {
+  if (size_t(end - p) < sizeof(T)) return false;
+  memcpy(&value, p, sizeof(T));
+  p += sizeof(T);
+  return true;
+}
+
+bool canvas_state::read_chunks() {
+  std::string chunks_path = path.string() + ".chunks";
+  std::ifstream fs(chunks_path.c_str(), std::ios::binary);
+  
+  if (fs.fail()) {
+    return false;
+  }
+  
+  std::string data((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+  
+  if (data.size() < sizeof(chunks_magic) || memcmp(data.data(), chunks_magic, sizeof(chunks_magic)) != 0) {
+    return false;
+  }
+  
+  const char *p = data.data() + sizeof(chunks_magic);
+  const char *end = data.data() + data.size();
+  
+  uint64_t w, h;
+  int32_t x0, z0, x1, z1;
+  uint32_t count;
+  
+  if (!get(p, end, w) || !get(p, end, h)
+      || !get(p, end, x0) || !get(p, end, z0) || !get(p, end, x1) || !get(p, end, z1)
+      || !get(p, end, count)) {
+    return false;
+  }
+  
+  chunk_map read;
+  
+  for (uint32_t i = 0; i < count; i++) {
+    int32_t x, z;
+    int64_t modified;
+    
+    if (!get(p, end, x) || !get(p, end, z) || !get(p, end, modified)) {
+      return false;
+    }
+    
+    read[std::make_pair(int(x), int(z))] = std::time_t(modified);
+  }
+  
+  width = w;
+  height = h;
+  min_x = x0;
+  min_z = z0;
+  max_x = x1;
+  max_z = z1;
+  chunks.swap(read);
+  return true;
+}
+
+bool canvas_state::write_chunks() {
+  std::string out;
+  
+  out.append(chunks_magic, sizeof(chunks_magic));
+  put<uint64_t>(out, width);
+  put<uint64_t>(out, height);
+  put<int32_t>(out, min_x);
+  put<int32_t>(out, min_z);
+  put<int32_t>(out, max_x);
+  put<int32_t>(out, max_z);
+  put<uint32_t>(out, chunks.size());
+  
+  for (chunk_map::iterator it = chunks.begin(); it != chunks.end(); it++) {
+    put<int32_t>(out, it->first.first);
+    put<int32_t>(out, it->first.second);
+    put<int64_t>(out, it->second);
+  }
+  
+  std::string chunks_path = path.string() + ".chunks";
+  std::string tmp = chunks_path + ".tmp";
+  
+  {
+    std::ofstream fs(tmp.c_str(), std::ios::binary | std::ios::trunc);
+    fs.write(out.data(), out.size());
+    
+    if (fs.fail()) {
+      return false;
+    }
+  }
+  
+  return rename(tmp.c_str(), chunks_path.c_str()) == 0;
+}
+
+bool canvas_state::read_pixels(memory_image& image) {
+  std::string raw_path = path.string() + ".raw";
+  FILE *fp = fopen(raw_path.c_str(), "rb");
+  
+  if (fp == NULL) {
+    return false;
+  }
+  
+  size_t size = image.get_width() * image.get_height() * sizeof(color);
+  
+  bool ok = fread(image.get_colors(), 1, size, fp) == size && fgetc(fp) == EOF;
+  
+  fclose(fp);
+  return ok;
+}
+
+bool canvas_state::write_pixels(memory_image& image, const dirty_grid* dirty) {
+  std::string raw_path = path.string() + ".raw";
+  
+  size_t row = image.get_width() * sizeof(color);
+  size_t h = image.get_height();
+  
+  FILE *fp = fopen(raw_path.c_str(), dirty == NULL ? "wb" : "r+b");
+  
+  if (fp == NULL) {
+    return false;
+  }
+  
+  bool ok = true;
+  
+  if (dirty == NULL) {
+    ok = fwrite(image.get_colors(), 1, row * h, fp) == row * h;
+  }
+  else {
+    for (size_t cy = 0; ok && cy < dirty->get_rows(); cy++) {
+      if (!dirty->is_row_dirty(cy)) {
+        continue;
+      }
+      
+      size_t y0 = cy * dirty_grid::CELL;
+      size_t y1 = std::min(h, y0 + dirty_grid::CELL);
+      
+      ok = fseeko(fp, off_t(y0) * row, SEEK_SET) == 0
+        && fwrite(image.get_colors() + y0 * row, 1, (y1 - y0) * row, fp) == (y1 - y0) * row;
+    }
+  }
+  
+  return fclose(fp) == 0 && ok;
+}
@@ -0,0 +1,63 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#ifndef _CANVAS_H_
+#define _CANVAS_H_
+
+#include <stdint.h>
+
+#include <ctime>
+#include <map>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "image.h"
+
+namespace fs = boost::filesystem;
+
+/**
+ * What an incremental render keeps in the cache directory between runs: the
+ * composited image (before any markers are drawn on it) and the
+ * modification time of every chunk that went into it.
+ *
+ * The image is stored as raw pixels in <path>.raw, so that a rerun only has
+ * to write back the rows it composited again. The chunks are written to
+ * <path>.chunks after the pixels, so that an interrupted write is redone the
+ * next time around.
+ */
+class canvas_state {
+public:
+  typedef std::map<std::pair<int, int>, std::time_t> chunk_map;
+  
+  const fs::path path;
+  
+  size_t width, height;
+  int min_x, min_z, max_x, max_z;
+  // keyed by the (rotated) chunk position
+  chunk_map chunks;
+  
+  canvas_state(const fs::path path) :
+    path(path), width(0), height(0), min_x(0), min_z(0), max_x(0), max_z(0)
+  {
+  }
+  
+  /*
+   * read the layout and chunks of the previous render, false if there is
+   * none.
+   */
+  bool read_chunks();
+  bool write_chunks();
+  
+  /*
+   * read the previous image, which must have the same size as `image'.
+   */
+  bool read_pixels(memory_image& image);
+  
+  /*
+   * write back the rows which have dirty cells in `dirty', or every row if
+   * it is NULL.
+   */
+  bool write_pixels(memory_image& image, const dirty_grid* dirty);
+};
+
+#endif /* _CANVAS_H_ */
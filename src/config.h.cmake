@@ -5,5 +5,8 @@
 #cmakedefine C10T_SITE "@C10T_SITE@"
 #cmakedefine C10T_CONTACT "@C10T_CONTACT@"
 #cmakedefine C10T_DISABLE_THREADS "@C10T_DISABLE_THREADS@"
+#cmakedefine C10T_HAVE_LIBDEFLATE
+#cmakedefine C10T_HAVE_IO_URING
+#cmakedefine C10T_HAVE_FIEMAP
 
 #endif /* HAVE_CONFIG_H */
@@ -2,4 +2,221 @@
 // (C) Copyright 2010 John-John Tedro et al.
 #include "fileutils.h"
 
+#include "config.h"
 
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if !defined(C10T_DISABLE_THREADS)
+#  include <boost/thread.hpp>
+#  include <boost/thread/mutex.hpp>
+#  include <boost/bind.hpp>
+#endif
+
+/*
+ * parse a base 36 number up to the terminating character `end'.
+ */
+static bool parse_b36(const char *&p, char end, int& value) {
+  bool negative = false;
+  
+  if (*p == '-') {
+    negative = true;
+    p++;
+  }
+  
+  long long n = 0;
+  const char *start = p;
+  
+  for (; *p != end; p++) {
+    int d;
+    
+    if (*p >= '0' && *p <= '9') d = *p - '0';
+    else if (*p >= 'a' && *p <= 'z') d = *p - 'a' + 10;
+    else if (*p >= 'A' && *p <= 'Z') d = *p - 'A' + 10;
+    else return false;
+    
+    n = n * 36 + d;
+    
+    if (n > INT_MAX) {
+      return false;
+    }
+  }
+  
+  if (p == start) {
+    return false;
+  }
+  
+  p++;
+  value = negative ? -int(n) : int(n);
+  return true;
+}
+
+bool parse_chunk_name(const char *name, int& x, int& z) {
+  if (name[0] != 'c' || name[1] != '.') {
+    return false;
+  }
+  
+  const char *p = name + 2;
+  
+  if (!parse_b36(p, '.', x) || !parse_b36(p, '.', z)) {
+    return false;
+  }
+  
+  return strcmp(p, "dat") == 0;
+}
+
+static bool has_dat_extension(const char *name) {
+  size_t length = strlen(name);
+  return length > 4 && strcmp(name + length - 4, ".dat") == 0;
+}
+
+enum entry_type {
+  OtherEntry,
+  DirectoryEntry,
+  FileEntry
+};
+
+/*
+ * the type of an entry, only stat'ed if readdir could not tell (or for
+ * symbolic links, which are followed).
+ */
+static entry_type get_entry_type(const std::string& path, struct dirent *ent) {
+#if defined(_DIRENT_HAVE_D_TYPE)
+  switch (ent->d_type) {
+    case DT_DIR: return DirectoryEntry;
+    case DT_REG: return FileEntry;
+    case DT_UNKNOWN:
+    case DT_LNK: break;
+    default: return OtherEntry;
+  }
+#endif
+  
+  struct stat st;
+  
+  if (stat(path.c_str(), &st) == -1) {
+    return OtherEntry;
+  }
+  
+  if (S_ISDIR(st.st_mode)) return DirectoryEntry;
+  if (S_ISREG(st.st_mode)) return FileEntry;
+  return OtherEntry;
+}
+
+/*
+ * list the entries of one directory, the subdirectories are added to `dirs'
+ * and the .dat files to `files'.
+ */
+static void list_directory(const std::string& dir, std::vector<std::string>& dirs, std::vector<chunk_file>& files) {
+  DIR *d = opendir(dir.c_str());
+  
+  if (d == NULL) {
+    return;
+  }
+  
+  struct dirent *ent;
+  
+  while ((ent = readdir(d)) != NULL) {
+    const char *name = ent->d_name;
+    
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+    
+    std::string path = dir + "/" + name;
+    
+    switch (get_entry_type(path, ent)) {
+      case DirectoryEntry:
+        dirs.push_back(path);
+        break;
+      case FileEntry:
+        if (has_dat_extension(name)) {
+          chunk_file f;
+          f.path = path;
+          f.named = parse_chunk_name(name, f.x, f.z);
+          files.push_back(f);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  
+  closedir(d);
+}
+
+/*
+ * the directories below root which are shared between the scanning threads
+ */
+struct chunk_scan {
+  std::vector<std::string> roots;
+  std::vector<chunk_file>& files;
+  size_t next;
+  
+#if !defined(C10T_DISABLE_THREADS)
+  boost::mutex mutex;
+#endif
+  
+  chunk_scan(std::vector<chunk_file>& files) : files(files), next(0) {}
+  
+  bool take(std::string& dir) {
+#if !defined(C10T_DISABLE_THREADS)
+    boost::mutex::scoped_lock lock(mutex);
+#endif
+    
+    if (next >= roots.size()) {
+      return false;
+    }
+    
+    dir = roots[next++];
+    return true;
+  }
+  
+  void give(std::vector<chunk_file>& found) {
+#if !defined(C10T_DISABLE_THREADS)
+    boost::mutex::scoped_lock lock(mutex);
+#endif
+    
+    files.insert(files.end(), found.begin(), found.end());
+  }
+  
+  void run() {
+    std::vector<chunk_file> found;
+    std::vector<std::string> dirs;
+    std::string dir;
+    
+    while (take(dir)) {
+      dirs.push_back(dir);
+      
+      while (!dirs.empty()) {
+        std::string next = dirs.back();
+        dirs.pop_back();
+        list_directory(next, dirs, found);
+      }
+    }
+    
+    give(found);
+  }
+};
+
+void find_chunk_files(const fs::path& root, int threads, std::vector<chunk_file>& files) {
+  chunk_scan scan(files);
+  
+  list_directory(root.string(), scan.roots, files);
+  
+#if !defined(C10T_DISABLE_THREADS)
+  if (threads > 1) {
+    boost::thread_group group;
+    
+    for (int i = 0; i < threads; i++) {
+      group.create_thread(boost::bind(&chunk_scan::run, &scan));
+    }
+    
+    group.join_all();
+    return;
+  }
+#endif
+  
+  scan.run();
+}
@@ -4,64 +4,37 @@
 #define _FILEUTILS_H_
 
 #include <string>
-#include <queue>
+#include <vector>
 
 #include <dirent.h>
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
 
-class dirlist {
-private:
-  std::queue<fs::path> directories;
-  std::queue<fs::path> files;
-
-public:
-  dirlist(const fs::path path) {
-    if (fs::is_directory(path))
-      directories.push(path);
-  }
-  
-  bool has_next() {
-    if (!files.empty()) {
-      return true;
-    }
-
-    if (directories.empty()) {
-      return false;
-    }
-    
-    // work until you find any files
-    while (!directories.empty()) {
-      fs::path dir_path = directories.front();
-      directories.pop();
-      
-      if (!fs::is_directory(dir_path)) {
-        return false;
-      }
-      
-      fs::directory_iterator end_itr;
-      for ( fs::directory_iterator itr( dir_path );
-            itr != end_itr;
-            ++itr )
-      {
-        if (fs::is_directory(itr->status())) {
-          directories.push(itr->path());
-        }
-        else if (fs::is_regular_file(itr->status())) {
-          files.push(itr->path());
-        }
-      }
-    }
-    
-    return !files.empty();
-  }
-
-  fs::path next() {
-    fs::path next = files.front();
-    files.pop();
-    return next;
-  }
+/*
+ * A .dat file found by find_chunk_files, the position is only set if the
+ * name matched c.<x>.<z>.dat.
+ */
+struct chunk_file {
+  std::string path;
+  bool named;
+  int x, z;
 };
 
+/*
+ * Decode the position out of a c.<x>.<z>.dat filename (base 36), without
+ * any allocations.
+ */
+bool parse_chunk_name(const char *name, int& x, int& z);
+
+/**
+ * Find every .dat file below root, where Alpha worlds keep their chunks in a
+ * 64x64 fan-out of directories.
+ *
+ * The directories directly below root are shared out between `threads'
+ * threads, and the entry types which readdir reports are used so that no
+ * entry needs a stat of its own. The files come in no particular order.
+ */
+void find_chunk_files(const fs::path& root, int threads, std::vector<chunk_file>& files);
+
 #endif /* _FILEUTILS_H_ */
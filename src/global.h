@@ -17,6 +17,24 @@
 
 namespace fs = boost::filesystem;
 
+/*
+ * order chunks are handed to the renderer in, see order_levels
+ */
+enum job_order {
+  RowOrder,
+  MortonOrder,
+  TileOrder
+};
+
+/*
+ * order the I/O threads read chunks in, see Reader
+ */
+enum io_order {
+  LevelIoOrder,
+  InodeIoOrder,
+  ExtentIoOrder
+};
+
 enum mode {
   Top,
   Oblique,
@@ -53,6 +71,13 @@ struct settings_t {
   int top;
   int bottom;
   unsigned int threads;
+  // reading chunks ahead of the render threads, 0 to read on those
+  unsigned int io_threads;
+  // chunk reads kept in flight (or hinted to the kernel) ahead of rendering
+  unsigned int io_depth;
+  enum io_order io_order;
+  // levels ahead of the render threads chunks may be read out of order in
+  unsigned int io_window;
   enum mode mode;
   unsigned int rotation;
   int min_x, max_x, min_z, max_z; // limits to draw
@@ -73,6 +98,11 @@ struct settings_t {
   fs::path write_markers_path;
   bool use_pixelsplit;
   int pixelsplit;
+  bool incremental;
+  bool watch;
+  enum job_order job_order;
+  // milliseconds without changes before a watched world is rendered again
+  int watch_delay;
   
   settings_t() {
     this->excludes = new bool[mc::MaterialCount];
@@ -83,15 +113,18 @@ struct settings_t {
 
 #   if !defined(C10T_DISABLE_THREADS)
       this->threads = boost::thread::hardware_concurrency();
+      this->io_threads = this->threads;
 #   else
       this->threads = 1;
+      this->io_threads = 0;
 #   endif
 
     this->use_split = false;
     this->split = 1;
     this->cavemode = false;
     this->excludes[mc::Air] = true;
-    this->top = 127;
+    // clamped to the height of the chunks being rendered
+    this->top = mc::anvil_geometry::MapY - 1;
     this->bottom = 0;
     this->mode = Top;
     this->nocheck = false;
@@ -132,6 +165,13 @@ struct settings_t {
     this->write_markers = false;
     this->use_pixelsplit = false;
     this->pixelsplit = 0;
+    this->incremental = false;
+    this->watch = false;
+    this->job_order = RowOrder;
+    this->watch_delay = 2000;
+    this->io_depth = 32;
+    this->io_order = LevelIoOrder;
+    this->io_window = 256;
   }
   
   ~settings_t() {
@@ -26,7 +26,6 @@ void image_operations::add_pixel(int x, int y, color &c) {
   
   oper.x = (uint16_t)x;
   oper.y = (uint16_t)y;
-  //oper.order = ++order;
   oper.c = c;
   
   if (!oper.c.is_transparent()) {
@@ -39,6 +38,7 @@ void image_operations::add_pixel(int x, int y, color &c) {
     lookup[p] = true;
   }
   
+  oper.depth = operations.size();
   operations.push_back(oper);
 }
 
@@ -96,6 +96,37 @@ void image_base::composite(int xoffset, int yoffset, image_operations &img) {
   }
 }
 
+void image_base::composite(int xoffset, int yoffset, image_operations &img, const dirty_grid& mask) {
+  std::vector<image_operation>::size_type i = img.operations.size();
+  
+  while (i--) {
+    image_operation op = img.operations[i];
+    
+    int x = xoffset + op.x, y = yoffset + op.y;
+    
+    if (x < 0 || y < 0 || !mask.is_dirty(x, y)) {
+      continue;
+    }
+    
+    color base;
+    get_pixel(x, y, base);
+    base.blend(op.c);
+    set_pixel(x, y, base);
+  }
+}
+
+void image_base::clear(const dirty_grid& mask) {
+  color blank(0x00, 0x00, 0x00, 0x00);
+  
+  for (size_t y = 0; y < get_height(); y++) {
+    for (size_t x = 0; x < get_width(); x++) {
+      if (mask.is_dirty(x, y)) {
+        set_pixel(x, y, blank);
+      }
+    }
+  }
+}
+
 void image_base::composite(int xoffset, int yoffset, image_base &img) {
   if (!(xoffset >= 0)) { return; }
   if (!(yoffset >= 0)) { return; }
@@ -274,6 +305,207 @@ void cached_image::blend_pixel(size_t x, size_t y, color &c){
   }
 }
 
+void dirty_grid::mark(int x, int y, size_t w, size_t h) {
+  int x1 = x + int(w), y1 = y + int(h);
+  
+  x = std::max(x, 0);
+  y = std::max(y, 0);
+  
+  for (int cy = y / int(CELL); cy < int(ch) && cy * int(CELL) < y1; cy++) {
+    for (int cx = x / int(CELL); cx < int(cw) && cx * int(CELL) < x1; cx++) {
+      std::vector<bool>::reference cell = cells[cy * cw + cx];
+      
+      if (!cell) {
+        cell = true;
+        count++;
+      }
+    }
+  }
+}
+
+bool dirty_grid::intersects(int x, int y, size_t w, size_t h) const {
+  int x1 = x + int(w), y1 = y + int(h);
+  
+  x = std::max(x, 0);
+  y = std::max(y, 0);
+  
+  for (int cy = y / int(CELL); cy < int(ch) && cy * int(CELL) < y1; cy++) {
+    for (int cx = x / int(CELL); cx < int(cw) && cx * int(CELL) < x1; cx++) {
+      if (cells[cy * cw + cx]) {
+        return true;
+      }
+    }
+  }
+  
+  return false;
+}
+
+const size_t depth_image::BAND;
+const uint32_t depth_image::NONE;
+const size_t depth_image::PIXEL_SIZE;
+
+depth_image::depth_image(memory_image& image, size_t memory_limit) :
+  image(image), w(image.get_width()), h(image.get_height()),
+  depths(w * h, 0), heads(w * h, NONE),
+  memory_limit(memory_limit), memory(0), full(false)
+{
+  for (size_t y = 0; y < h; y += BAND) {
+    bands.push_back(new band());
+  }
+}
+
+depth_image::~depth_image() {
+  for (std::vector<band*>::iterator it = bands.begin(); it != bands.end(); it++) {
+    delete *it;
+  }
+}
+
+bool depth_image::grow(band* b) {
+  size_t capacity = std::max(b->fragments.capacity() * 2, size_t(1024));
+  size_t more = (capacity - b->fragments.capacity()) * sizeof(fragment);
+  
+  {
+#   if !defined(C10T_DISABLE_THREADS)
+      boost::mutex::scoped_lock lock(memory_mutex);
+#   endif
+    
+    if (full || memory + more > memory_limit) {
+      full = true;
+      return false;
+    }
+    
+    memory += more;
+  }
+  
+  b->fragments.reserve(capacity);
+  return true;
+}
+
+void depth_image::composite(int xoffset, int yoffset, size_t order, image_operations& oper, const dirty_grid* mask) {
+  std::vector<image_operation>& ops = oper.operations;
+  
+  if (ops.empty() || full) {
+    return;
+  }
+  
+  int min_y = INT_MAX, max_y = INT_MIN;
+  
+  for (std::vector<image_operation>::iterator it = ops.begin(); it != ops.end(); it++) {
+    min_y = std::min(min_y, yoffset + it->y);
+    max_y = std::max(max_y, yoffset + it->y);
+  }
+  
+  if (max_y < 0 || min_y >= int(h)) {
+    return;
+  }
+  
+  size_t first = std::max(min_y, 0) / BAND;
+  size_t last = std::min(size_t(max_y), h - 1) / BAND;
+  
+  // bands are locked top to bottom by everyone, so two chunks never wait
+  // on each other
+# if !defined(C10T_DISABLE_THREADS)
+    for (size_t b = first; b <= last; b++) {
+      bands[b]->mutex.lock();
+    }
+# endif
+  
+  // later chunks are in front, and the earlier operations of a chunk
+  uint64_t chunk_depth = uint64_t(order + 1) << 32;
+  
+  for (std::vector<image_operation>::iterator it = ops.begin(); it != ops.end(); it++) {
+    int x = xoffset + it->x, y = yoffset + it->y;
+    
+    if (x < 0 || y < 0 || size_t(x) >= w || size_t(y) >= h) {
+      continue;
+    }
+    
+    if (mask != NULL && !mask->is_dirty(x, y)) {
+      continue;
+    }
+    
+    uint64_t depth = chunk_depth | (0xffffffff - uint32_t(it->depth));
+    size_t p = x + y * w;
+    
+    if (depth < depths[p]) {
+      continue;
+    }
+    
+    if (it->c.is_opaque()) {
+      depths[p] = depth;
+      image.set_pixel(x, y, it->c);
+      continue;
+    }
+    
+    band* b = bands[y / BAND];
+    
+    if (b->fragments.size() == b->fragments.capacity() && !grow(b)) {
+      break;
+    }
+    
+    fragment f = { depth, it->c, heads[p] };
+    heads[p] = b->fragments.size();
+    b->fragments.push_back(f);
+  }
+  
+# if !defined(C10T_DISABLE_THREADS)
+    for (size_t b = first; b <= last; b++) {
+      bands[b]->mutex.unlock();
+    }
+# endif
+}
+
+struct compare_fragment_depth {
+  template <class F>
+  bool operator()(const F* a, const F* b) const {
+    return a->depth < b->depth;
+  }
+};
+
+void depth_image::resolve() {
+  std::vector<fragment*> list;
+  
+  for (size_t y = 0; y < h; y++) {
+    band* b = bands[y / BAND];
+    
+    for (size_t x = 0; x < w; x++) {
+      size_t p = x + y * w;
+      
+      list.clear();
+      
+      // the ones behind an opaque operation added after them are hidden
+      for (uint32_t f = heads[p]; f != NONE; f = b->fragments[f].next) {
+        if (b->fragments[f].depth > depths[p]) {
+          list.push_back(&b->fragments[f]);
+        }
+      }
+      
+      if (list.empty()) {
+        continue;
+      }
+      
+      std::sort(list.begin(), list.end(), compare_fragment_depth());
+      
+      color base;
+      image.get_pixel(x, y, base);
+      
+      for (std::vector<fragment*>::iterator it = list.begin(); it != list.end(); it++) {
+        base.blend((*it)->c);
+      }
+      
+      image.set_pixel(x, y, base);
+    }
+  }
+  
+  for (std::vector<band*>::iterator it = bands.begin(); it != bands.end(); it++) {
+    std::vector<fragment>().swap((*it)->fragments);
+  }
+  
+  std::fill(depths.begin(), depths.end(), 0);
+  std::fill(heads.begin(), heads.end(), NONE);
+  memory = 0;
+}
+
 std::map<point2, image_base*> image_split(image_base* base, int pixels) {
   std::map<point2, image_base*> map;
   
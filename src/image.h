@@ -3,6 +3,8 @@
 #ifndef _IMG_H_
 #define _IMG_H_
 
+#include "config.h"
+
 #include "2d/cube.h"
 #include "color.h"
 
@@ -19,6 +21,10 @@
 
 #include <fstream>
 
+#if !defined(C10T_DISABLE_THREADS)
+#  include <boost/thread/mutex.hpp>
+#endif
+
 #include <boost/ptr_container/ptr_map.hpp>
 #include <boost/numeric/conversion/cast.hpp>
 
@@ -26,6 +32,7 @@ typedef std::streamsize offs_t;
 
 struct image_operation {
   color c;
+  // order the operation was added to its chunk in, nearest first
   int depth;
   uint16_t x, y;
 };
@@ -77,6 +84,48 @@ public:
 
 class virtual_image;
 
+/*
+ * A coarse mask over an image, in cells of CELL x CELL pixels, of the parts
+ * that have to be composited again.
+ */
+class dirty_grid {
+private:
+  size_t cw, ch;
+  std::vector<bool> cells;
+  size_t count;
+public:
+  static const size_t CELL = 16;
+  
+  dirty_grid(size_t w, size_t h) :
+    cw((w + CELL - 1) / CELL), ch((h + CELL - 1) / CELL), cells(cw * ch, false), count(0)
+  {
+  }
+  
+  /*
+   * mark the cells overlapping the area, the parts of it outside of the
+   * image are ignored.
+   */
+  void mark(int x, int y, size_t w, size_t h);
+  
+  bool intersects(int x, int y, size_t w, size_t h) const;
+  
+  inline bool is_dirty(size_t x, size_t y) const {
+    size_t cx = x / CELL, cy = y / CELL;
+    return cx < cw && cy < ch && cells[cy * cw + cx];
+  }
+  
+  inline bool is_row_dirty(size_t cy) const {
+    for (size_t cx = 0; cx < cw; cx++) {
+      if (cells[cy * cw + cx]) return true;
+    }
+    
+    return false;
+  }
+  
+  inline size_t get_rows() const { return ch; }
+  inline bool empty() const { return count == 0; }
+};
+
 class image_base {
 protected:
   size_t w, h;
@@ -92,11 +141,15 @@ public:
   }
   
   void fill(color& c);
+  // make the dirty cells of the mask transparent
+  void clear(const dirty_grid& mask);
   
   inline size_t get_width() { return w; };
   inline size_t get_height() { return h; };
   
   void composite(int xoffset, int yoffset, image_operations& oper);
+  // only the operations falling on dirty cells of the mask
+  void composite(int xoffset, int yoffset, image_operations& oper, const dirty_grid& mask);
   void composite(int xoffset, int yoffset, image_base& img);
   void safe_composite(int xoffset, int yoffset, image_base& img);
   
@@ -137,6 +190,10 @@ public:
   ~memory_image() {
     delete [] colors;
   }
+  
+  uint8_t* get_colors() {
+    return colors;
+  }
 
   void blend_pixel(size_t x, size_t y, color &c);
   void set_pixel(size_t x, size_t y, color&);
@@ -144,6 +201,79 @@ public:
   void get_line(size_t y, size_t offset, size_t width, color*);
 };
 
+/*
+ * Composites chunks into a memory image in any order, and from any number of
+ * threads at once.
+ *
+ * An operation is as deep as the order of its chunk and, within the chunk,
+ * its image_operation::depth. The nearest opaque operation of every pixel is
+ * written straight to the image with its depth kept in a plane next to it,
+ * translucent operations in front of that are listed for the pixel. resolve()
+ * blends those back to front, which gives exactly the image compositing the
+ * chunks one at a time in order would.
+ *
+ * Those lists are kept until the end, so they are limited to memory_limit
+ * bytes. Once they would need more the depth image is full, and the chunks
+ * have to be composited some other way.
+ */
+class depth_image {
+private:
+  struct fragment {
+    uint64_t depth;
+    color c;
+    uint32_t next;
+  };
+  
+  // the fragments of a band of rows, and the lock for writing to them
+  struct band {
+    std::vector<fragment> fragments;
+#   if !defined(C10T_DISABLE_THREADS)
+      boost::mutex mutex;
+#   endif
+  };
+  
+  memory_image& image;
+  size_t w, h;
+  // of the nearest opaque operation of every pixel, 0 for none
+  std::vector<uint64_t> depths;
+  // first fragment of every pixel in its band, NONE for none
+  std::vector<uint32_t> heads;
+  std::vector<band*> bands;
+  
+  // bytes the fragments of every band may take, and take
+  const size_t memory_limit;
+  size_t memory;
+  volatile bool full;
+# if !defined(C10T_DISABLE_THREADS)
+    boost::mutex memory_mutex;
+# endif
+  
+  // make room for more fragments in b, false if that would take too much
+  bool grow(band* b);
+public:
+  static const size_t BAND = 64;
+  static const uint32_t NONE = 0xffffffff;
+  // bytes kept for every pixel of the image on top of its color
+  static const size_t PIXEL_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+  
+  depth_image(memory_image& image, size_t memory_limit);
+  ~depth_image();
+  
+  /*
+   * composite the operations of the chunk which is order:th in the painters
+   * order, only on the dirty parts of the image if mask is set.
+   */
+  void composite(int xoffset, int yoffset, size_t order, image_operations& oper, const dirty_grid* mask);
+  
+  // if the fragments ran out of memory, which leaves the image unfinished
+  bool is_full() const {
+    return full;
+  }
+  
+  // blend the translucent fragments into the image, once everything is in
+  void resolve();
+};
+
 class virtual_image : public image_base {
 private:
   image_base* base;
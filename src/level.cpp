@@ -15,116 +15,232 @@
 
 #include <ctime>
 
-void begin_compound(level_file* level, nbt::String name) {
-  if (name.compare("Level") == 0) {
-    level->islevel = true;
-    return;
-  }
-}
+/*
+ * tag names compared against by the handlers below
+ */
+static const nbt::NameKey Level_key("Level");
+static const nbt::NameKey Blocks_key("Blocks");
+static const nbt::NameKey SkyLight_key("SkyLight");
+static const nbt::NameKey BlockLight_key("BlockLight");
+static const nbt::NameKey TileEntities_key("TileEntities");
+static const nbt::NameKey Sections_key("Sections");
+static const nbt::NameKey Y_key("Y");
+static const nbt::NameKey id_key("id");
+static const nbt::NameKey x_key("x");
+static const nbt::NameKey y_key("y");
+static const nbt::NameKey z_key("z");
+static const nbt::NameKey xPos_key("xPos");
+static const nbt::NameKey zPos_key("zPos");
 
-void register_string(level_file* level, nbt::String name, nbt::String value) {
-  if (!level->in_te) {
-    return;
+/*
+ * Handler collecting the byte arrays and signs of a chunk file.
+ */
+struct level_handler : nbt::null_handler {
+  static const bool has_string = true;
+  static const bool has_int = true;
+  static const bool has_byte = true;
+  static const bool has_byte_array = true;
+  
+  level_file* level;
+  
+  // the Anvil section being read, tags of a section come in any order
+  bool in_sections;
+  int section_y;
+  nbt::ByteArray *section_blocks, *section_skylight, *section_blocklight;
+  
+  level_handler(level_file* level) :
+    level(level),
+    in_sections(false),
+    section_y(-1),
+    section_blocks(NULL), section_skylight(NULL), section_blocklight(NULL)
+  {
   }
   
-  if (level->in_sign) {
-    if (level->sign_text.size() == 0) {
-      level->sign_text = value;
-    }
-    else {
-      level->sign_text += "\n" + value;
-    }
-    
-    return;
+  ~level_handler() {
+    delete section_blocks;
+    delete section_skylight;
+    delete section_blocklight;
   }
   
-  if (name.compare("id") == 0 && value.compare("Sign") == 0) {
-    level->in_sign = true;
+  inline void begin_compound(const nbt::Name& name) {
+    if (name == Level_key) {
+      level->islevel = true;
+      return;
+    }
   }
-}
-
-void register_int(level_file* level, nbt::String name, nbt::Int i) {
-  if (level->in_te) {
+  
+  inline void register_string(const nbt::Name& name, const nbt::String& value) {
+    if (!level->in_te) {
+      return;
+    }
+    
     if (level->in_sign) {
-      if (name.compare("x") == 0) {
-        level->sign_x = i;
+      if (level->sign_text.size() == 0) {
+        level->sign_text = value;
       }
-      else if (name.compare("y") == 0) {
-        level->sign_y = i;
-      }
-      else if (name.compare("z") == 0) {
-        level->sign_z = i;
+      else {
+        level->sign_text += "\n" + value;
       }
+      
+      return;
     }
     
-    return;
-  }
-}
-
-void register_byte_array(level_file* level, nbt::String name, nbt::ByteArray* byte_array) {
-  if (!level->islevel) {
-    delete byte_array;
-    return;
+    if (name == id_key && value.compare("Sign") == 0) {
+      level->in_sign = true;
+    }
   }
   
-  if (name.compare("Blocks") == 0) {
-    level->blocks.reset(byte_array);
-    return;
+  inline void register_int(const nbt::Name& name, nbt::Int i) {
+    if (level->in_te) {
+      if (level->in_sign) {
+        if (name == x_key) {
+          level->sign_x = i;
+        }
+        else if (name == y_key) {
+          level->sign_y = i;
+        }
+        else if (name == z_key) {
+          level->sign_z = i;
+        }
+      }
+      
+      return;
+    }
   }
   
-  if (name.compare("SkyLight") == 0) {
-    level->skylight.reset(byte_array);
-    return;
+  inline void register_byte(const nbt::Name& name, nbt::Byte b) {
+    if (in_sections && name == Y_key) {
+      section_y = b;
+    }
   }
-
-  if (name.compare("HeightMap") == 0) {
-    level->heightmap.reset(byte_array);
-    return;
+  
+  inline void register_byte_array(const nbt::Name& name, nbt::ByteArray* byte_array) {
+    if (!level->islevel) {
+      delete byte_array;
+      return;
+    }
+    
+    if (in_sections) {
+      nbt::ByteArray **target = NULL;
+      
+      if (name == Blocks_key) target = &section_blocks;
+      else if (name == SkyLight_key) target = &section_skylight;
+      else if (name == BlockLight_key) target = &section_blocklight;
+      
+      if (target == NULL) {
+        delete byte_array;
+        return;
+      }
+      
+      delete *target;
+      *target = byte_array;
+      return;
+    }
+    
+    if (name == Blocks_key) {
+      level->blocks.reset(byte_array);
+      return;
+    }
+    
+    if (name == SkyLight_key) {
+      level->skylight.reset(byte_array);
+      return;
+    }
+    
+    if (name == BlockLight_key) {
+      level->blocklight.reset(byte_array);
+      return;
+    }
+    
+    delete byte_array;
   }
   
-  if (name.compare("BlockLight") == 0) {
-    level->blocklight.reset(byte_array);
-    return;
+  inline void begin_list(const nbt::Name& name, nbt::Byte type, nbt::Int count) {
+    if (name == TileEntities_key) {
+      level->in_te = true;
+    }
+    
+    if (level->islevel && name == Sections_key) {
+      in_sections = true;
+      level->anvil = true;
+    }
   }
   
-  delete byte_array;
-}
-
-void begin_list(level_file* level, nbt::String name, nbt::Byte type, nbt::Int count) {
-  if (name.compare("TileEntities") == 0) {
-    level->in_te = true;
+  inline void end_list(const nbt::Name& name) {
+    if (name == TileEntities_key) {
+      level->in_te = false;
+    }
+    
+    if (name == Sections_key) {
+      in_sections = false;
+    }
   }
-}
-
-void end_list(level_file* level, nbt::String name) {
-  if (name.compare("TileEntities") == 0) {
-    level->in_te = false;
+  
+  /*
+   * hand a complete section over to the level
+   */
+  inline void end_section() {
+    if (section_y >= 0 && section_y < level_file::ANVIL_SECTIONS && section_blocks != NULL) {
+      level->section_blocks[section_y].reset(section_blocks);
+      level->section_skylight[section_y].reset(section_skylight);
+      level->section_blocklight[section_y].reset(section_blocklight);
+    }
+    else {
+      delete section_blocks;
+      delete section_skylight;
+      delete section_blocklight;
+    }
+    
+    section_y = -1;
+    section_blocks = section_skylight = section_blocklight = NULL;
   }
-}
-
-void end_compound(level_file* level, nbt::String name) {
-  if (level->in_te) {
-    if (level->in_sign) {
-      level->in_sign = false;
-      light_marker m(level->sign_text, level->sign_x, level->sign_y, level->sign_z);
-      level->markers.push_back(m);
-      level->sign_text = "";
-      level->sign_x = 0;
-      level->sign_y = 0;
-      level->sign_z = 0;
+  
+  inline void end_compound(const nbt::Name& name) {
+    if (in_sections) {
+      end_section();
+      return;
+    }
+    
+    if (level->in_te) {
+      if (level->in_sign) {
+        level->in_sign = false;
+        light_marker m(level->sign_text, level->sign_x, level->sign_y, level->sign_z);
+        level->markers.push_back(m);
+        level->sign_text = "";
+        level->sign_x = 0;
+        level->sign_y = 0;
+        level->sign_z = 0;
+      }
     }
   }
-}
-
-void error_handler(level_file* level, size_t where, const char *why) {
-  level->grammar_error = true;
-  level->grammar_error_where = where;
-  level->grammar_error_why = why;
-}
+  
+  inline void error_handler(size_t where, const char *why) {
+    level->grammar_error = true;
+    level->grammar_error_where = where;
+    level->grammar_error_why = why;
+  }
+};
 
 #include <iostream>
 
 level_file::~level_file(){
+  blocks.reset();
+  skylight.reset();
+  blocklight.reset();
+  
+  for (int i = 0; i < ANVIL_SECTIONS; i++) {
+    section_blocks[i].reset();
+    section_skylight[i].reset();
+    section_blocklight[i].reset();
+  }
+  
+  if (buffer != NULL) {
+    nbt::release_buffer(buffer);
+  }
+  
+  if (raw != NULL) {
+    nbt::release_buffer(raw);
+  }
 }
 
 level_file::level_file(settings_t& s)
@@ -139,47 +255,205 @@ level_file::level_file(settings_t& s)
     cache(s.cache_dir, s.cache_compress),
     cache_use(s.cache_use),
     cache_hit(false),
+    anvil(false),
+    empty_sections(0),
+    buffer(NULL),
+    prefetched(false),
+    raw(NULL),
+    raw_error(NULL),
     oper(new image_operations)
 { }
 
-void level_file::load_file(const fs::path path) {
-  if (cache_use) {
-    cache.set_path(fs::basename(path) + ".cmap" );
+void build_level_query(settings_t& s, nbt::path_query& query, bool anvil) {
+  if (anvil) {
+    query.add("Level/Sections/*/Y");
+    query.add("Level/Sections/*/Blocks");
+    query.add("Level/Sections/*/SkyLight");
+    query.add("Level/Sections/*/BlockLight");
+    
+    if (s.show_signs) {
+      query.add("Level/TileEntities");
+    }
     
-    std::time_t level_mod = fs::last_write_time(path);
+    return;
+  }
   
-    if (fs::exists(cache.get_path())) {
-      if (cache.read(oper.get(), level_mod)) {
-        cache_hit = true;
-        islevel = true;
-        return;
-      }
-      
-      fs::remove(cache.get_path());
+  query.add("Level/Blocks");
+  query.add("Level/SkyLight");
+  query.add("Level/BlockLight");
+  
+  if (s.show_signs) {
+    query.add("Level/TileEntities");
+  }
+}
+
+void get_level_limits(settings_t& s, int height, size_t& w, size_t& h) {
+  Cube c(mc::MapX + 1, height + 1, mc::MapZ + 1);
+  
+  switch (s.mode) {
+  case Top:           c.get_top_limits(w, h);           break;
+  case Oblique:       c.get_oblique_limits(w, h);       break;
+  case ObliqueAngle:  c.get_obliqueangle_limits(w, h);  break;
+  case Isometric:     c.get_isometric_limits(w, h);     break;
+  }
+  
+  w += 1;
+}
+
+bool level_file::read_cache(const fs::path name, std::time_t mod) {
+  cache.set_path(name);
+  
+  if (fs::exists(cache.get_path())) {
+    if (cache.read(oper.get(), mod)) {
+      cache_hit = true;
+      islevel = true;
+      return true;
     }
     
-    // in case of future writes, save the modification time
-    cache.set_modification_time(level_mod);
+    fs::remove(cache.get_path());
+  }
+  
+  // in case of future writes, save the modification time
+  cache.set_modification_time(mod);
+  return false;
+}
+
+/*
+ * same names for chunks in regions as for chunk files, so that caches carry
+ * over
+ */
+inline std::string region_cache_name(int x, int z) {
+  using common::b36encode;
+  return "c." + b36encode(x) + "." + b36encode(z) + ".cmap";
+}
+
+bool level_file::prefetch_cache(const fs::path path) {
+  prefetched = true;
+  return cache_use && read_cache(fs::basename(path) + ".cmap", fs::last_write_time(path));
+}
+
+void level_file::prefetch_file(const fs::path path) {
+  if (prefetch_cache(path)) {
+    return;
   }
   
-  nbt::Parser<level_file> parser(this);
+  raw = nbt::acquire_buffer();
+  raw_error = nbt::read_file(path.string().c_str(), *raw);
+}
+
+void level_file::load_file(const fs::path path, const nbt::path_query* query) {
+  if (cache_use && !prefetched) {
+    if (read_cache(fs::basename(path) + ".cmap", fs::last_write_time(path))) {
+      return;
+    }
+  }
+  
+  if (cache_hit) {
+    return;
+  }
   
-  parser.register_byte_array = register_byte_array;
-  parser.register_string = register_string;
-  parser.register_int = register_int;
-  parser.begin_compound = begin_compound;
-  parser.begin_list = begin_list;
-  parser.end_list = end_list;
-  parser.end_compound = end_compound;
-  parser.error_handler = error_handler;
+  level_handler handler(this);
+  nbt::basic_parser<level_handler> parser(handler);
   
-  parser.parse_file(path.string().c_str());
+  parser.zero_copy = true;
+  parser.query = query;
+  
+  buffer = nbt::acquire_buffer();
+  
+  if (!prefetched) {
+    parser.parse_file(path.string().c_str(), *buffer);
+    return;
+  }
+  
+  const char *why = raw_error;
+  
+  if (why == NULL) {
+    why = nbt::inflate_buffer(raw->data, raw->size, *buffer);
+  }
+  
+  nbt::release_buffer(raw);
+  raw = NULL;
+  
+  if (why != NULL) {
+    handler.error_handler(0, why);
+    return;
+  }
+  
+  parser.parse_buffer(buffer->data, buffer->size);
 }
 
+bool level_file::prefetch_cache(const region_file& region, int x, int z) {
+  prefetched = true;
+  return cache_use && read_cache(region_cache_name(x, z), region.get_timestamp(x, z));
+}
+
+void level_file::prefetch_region(const region_file& region, int x, int z) {
+  if (prefetch_cache(region, x, z)) {
+    return;
+  }
+  
+  raw = nbt::acquire_buffer();
+  raw_error = region.read_raw(x, z, *raw);
+}
+
+void level_file::load_region(const region_file& region, int x, int z, const nbt::path_query* query) {
+  if (cache_use && !prefetched) {
+    if (read_cache(region_cache_name(x, z), region.get_timestamp(x, z))) {
+      return;
+    }
+  }
+  
+  if (cache_hit) {
+    return;
+  }
+  
+  level_handler handler(this);
+  nbt::basic_parser<level_handler> parser(handler);
+  
+  parser.zero_copy = true;
+  parser.query = query;
+  
+  // chunks of an Anvil region share its height, whatever they contain
+  anvil = region.anvil;
+  
+  buffer = nbt::acquire_buffer();
+  
+  const char *why;
+  
+  if (!prefetched) {
+    why = region.read_chunk(x, z, *buffer);
+  }
+  else {
+    why = raw_error;
+    
+    if (why == NULL) {
+      why = nbt::inflate_buffer(raw->data, raw->size, *buffer);
+    }
+    
+    nbt::release_buffer(raw);
+    raw = NULL;
+  }
+  
+  if (why != NULL) {
+    handler.error_handler(0, why);
+    return;
+  }
+  
+  parser.parse_buffer(buffer->data, buffer->size);
+}
+
+/*
+ * Reads the arrays of a chunk with geometry G, as seen from the rotation.
+ */
+template<typename G>
 class BlockRotation {
 private:
   settings_t& s;
   nbt::ByteArray *byte_array;
+  // the sections of Anvil chunks, which have no byte_array
+  const boost::scoped_ptr<nbt::ByteArray> *sections;
+  // the value of everything in absent sections
+  int absent;
 
   int x, z;
 
@@ -187,23 +461,38 @@ private:
     int t = x;
     switch (s.rotation) {
       case 270:
-        x = mc::MapX - z - 1;
+        x = G::MapX - z - 1;
         z = t;
         break;
       case 180:
-        z = mc::MapZ - z - 1;
-        x = mc::MapX - x - 1;
+        z = G::MapZ - z - 1;
+        x = G::MapX - x - 1;
         break;
       case 90:
         x = z;
-        z = mc::MapZ - t - 1;
+        z = G::MapZ - t - 1;
         break;
     };
   }
+  
+  /*
+   * the section array holding y and the index of y in it, NULL if there is
+   * no such section.
+   */
+  nbt::ByteArray *section(int y, int& p) {
+    if (!(y >= 0 && y < G::MapY)) {
+      p = -1;
+      return NULL;
+    }
+    
+    p = x + (z * G::MapX) + (y % level_file::SECTION_HEIGHT) * G::MapX * G::MapZ;
+    return sections[y / level_file::SECTION_HEIGHT].get();
+  }
 
 public:
-  BlockRotation(settings_t& s, nbt::ByteArray *byte_array)
-    : s(s), byte_array(byte_array) {}
+  BlockRotation(settings_t& s, nbt::ByteArray *byte_array,
+      const boost::scoped_ptr<nbt::ByteArray> *sections, int absent)
+    : s(s), byte_array(byte_array), sections(sections), absent(absent) {}
 
   void set_xz(int x, int z) {
     transform_xz(x, z);
@@ -213,49 +502,182 @@ public:
   
   /**
    * Blocks[ z + ( y * ChunkSizeY(=128) + ( x * ChunkSizeY(=128) * ChunkSizeZ(=16) ) ) ]; 
+   *
+   * or for Anvil sections, Blocks[ x + z * 16 + (y % 16) * 16 * 16 ]
    */
   uint8_t get8(int y) {
-    int p = y + (z * mc::MapY) + (x * mc::MapY * mc::MapZ);
+    if (byte_array == NULL) {
+      int p;
+      nbt::ByteArray *a = section(y, p);
+      if (p == -1) return -1;
+      if (a == NULL) return absent;
+      if (!(p < a->length)) return -1;
+      return a->values[p];
+    }
+    
+    int p = y + (z * G::MapY) + (x * G::MapY * G::MapZ);
     if (!(p >= 0 && p < byte_array->length)) return -1;
     return byte_array->values[p];
   }
   
-  uint8_t get8() {
-    int p = x + (z * mc::MapX);
-    assert (p >= 0 && p < byte_array->length);
-    return byte_array->values[p];
-  }
-  
   int get4(int y) {
-    int p = (y + (z * mc::MapY) + (x * mc::MapY * mc::MapZ)) >> 1;
+    if (byte_array == NULL) {
+      int p;
+      nbt::ByteArray *a = section(y, p);
+      if (p == -1) return -1;
+      if (a == NULL) return absent;
+      if (!((p >> 1) < a->length)) return -1;
+      return ((a->values[p >> 1]) >> ((p % 2) * 4)) & 0xf;
+    }
+    
+    int p = (y + (z * G::MapY) + (x * G::MapY * G::MapZ)) >> 1;
     if (!(p >= 0 && p < byte_array->length)) return -1;
     return ((byte_array->values[p]) >> ((y % 2) * 4)) & 0xf;
   }
 };
 
-inline void apply_shading(settings_t& s, int bl, int sl, int hm, int y, color &c) {
+/*
+ * if no array of blocks is something else than air (which is block 0)
+ */
+inline bool is_all_air(const nbt::Byte *values, int length) {
+  uint64_t any = 0;
+  int i = 0;
+  
+  for (; i + 8 <= length; i += 8) {
+    uint64_t v;
+    memcpy(&v, values + i, sizeof(v));
+    any |= v;
+  }
+  
+  for (; i < length; i++) {
+    any |= uint8_t(values[i]);
+  }
+  
+  return any == 0;
+}
+
+void level_file::find_empty_sections() {
+  empty_sections = 0;
+  
+  if (anvil) {
+    for (int i = 0; i < ANVIL_SECTIONS; i++) {
+      nbt::ByteArray *a = section_blocks[i].get();
+      
+      if (a == NULL || is_all_air(a->values, a->length)) {
+        empty_sections |= uint32_t(1) << i;
+      }
+    }
+    
+    return;
+  }
+  
+  typedef mc::alpha_geometry G;
+  
+  if (blocks.get() == NULL || blocks->length < G::MapX * G::MapY * G::MapZ) {
+    return;
+  }
+  
+  int count = G::MapY / SECTION_HEIGHT;
+  uint32_t all = (uint32_t(1) << count) - 1;
+  uint32_t present = 0;
+  
+  // Alpha chunks store the blocks of each column in sequence
+  for (int c = 0; c < G::MapX * G::MapZ && present != all; c++) {
+    const nbt::Byte *column = blocks->values + c * G::MapY;
+    
+    for (int i = 0; i < count; i++) {
+      if (!is_all_air(column + i * SECTION_HEIGHT, SECTION_HEIGHT)) {
+        present |= uint32_t(1) << i;
+      }
+    }
+  }
+  
+  empty_sections = all & ~present;
+}
+
+/*
+ * if air never draws anything with these settings, so that the render loops
+ * may skip over sections of nothing but air.
+ */
+inline bool air_is_invisible(settings_t& s) {
+  return !s.heightmap
+    && mc::MaterialColor[mc::Air].is_invisible()
+    && mc::MaterialSideColor[mc::Air].is_invisible();
+}
+
+/*
+ * move y to the bottom of its section if that section can be skipped.
+ */
+inline bool skip_section(bool skip_air, uint32_t empty_sections, int& y) {
+  if (!skip_air || !((empty_sections >> (y / level_file::SECTION_HEIGHT)) & 1)) {
+    return false;
+  }
+  
+  y -= y % level_file::SECTION_HEIGHT;
+  return true;
+}
+
+/*
+ * The settings the render kernels are specialized on, so that the inner
+ * loops don't test for them block by block.
+ */
+enum render_feature {
+  CaveFeature = 0x1,
+  NightFeature = 0x2,
+  HeightmapFeature = 0x4,
+  StripedFeature = 0x8,
+  ExcludesFeature = 0x10,
+  AllFeatures = 0x1f
+};
+
+unsigned int render_features(settings_t& s) {
+  unsigned int f = 0;
+  
+  if (s.cavemode) f |= CaveFeature;
+  if (s.striped_terrain) f |= StripedFeature;
+  
+  // the heightmap replaces the color whatever light there is
+  if (s.heightmap) f |= HeightmapFeature;
+  else if (s.night) f |= NightFeature;
+  
+  // air is always excluded unless asked for, which the kernels take for
+  // granted without the feature
+  if (!s.excludes[mc::Air]) f |= ExcludesFeature;
+  
+  for (int i = 0; i < mc::MaterialCount; i++) {
+    if (i != mc::Air && s.excludes[i]) {
+      f |= ExcludesFeature;
+      break;
+    }
+  }
+  
+  return f;
+}
+
+template<unsigned int F>
+inline void apply_shading(int top, int bl, int sl, int y, color &c) {
   // if night, darken all colors not emitting light
   
   if (bl == -1) bl = 0;
   
-  if(s.night) {
+  if (F & NightFeature) {
     c.darken(0xa * (16 - bl));
   }
-  else if (sl != -1 && y != s.top) {
+  else if (!(F & HeightmapFeature) && sl != -1 && y != top) {
     c.darken(0xa * (16 - std::max(sl, bl)));
   }
   
   //c.darken((mc::MapY - y));
   
   // in heightmap mode, brightness = height
-  if (s.heightmap) {
+  if (F & HeightmapFeature) {
     c.b = y*2;
     c.g = y*2;
     c.r = y*2;
     c.a = 0xff;
   }
   
-  if (s.striped_terrain && y % 2 == 0) {
+  if ((F & StripedFeature) && y % 2 == 0) {
     c.darken(0xf);
   }
 }
@@ -272,7 +694,8 @@ inline bool cave_isopen(int bt) {
   }
 }
 
-inline bool cave_ignore_block(settings_t& s, int y, int bt, BlockRotation& b_r, bool &cave_initial) {
+template<typename G>
+inline bool cave_ignore_block(settings_t& s, int y, int bt, BlockRotation<G>& b_r, bool &cave_initial) {
   if (cave_initial) {
     if (!cave_isopen(bt)) {
       cave_initial = false;
@@ -289,205 +712,247 @@ inline bool cave_ignore_block(settings_t& s, int y, int bt, BlockRotation& b_r,
   return true;
 }
 
-boost::shared_ptr<image_operations> level_file::get_image(settings_t& s) {
-  if (cache_hit) return oper;
-  
-  Cube c(mc::MapX + 1, mc::MapY + 1, mc::MapZ + 1);
+/*
+ * The projections of the render modes, where the blocks of a chunk land on
+ * its image and what they are drawn as there.
+ *
+ * COLUMNS is set when every block of a column lands on the same pixel, so
+ * that the column is done with at its first opaque block. Otherwise the
+ * pixels blocks land on are marked as they are covered, for the blocks
+ * which occlude() what is behind them.
+ */
+struct top_projection {
+  static const bool COLUMNS = true;
+  // the bottom slice has never been drawn from the top
+  static const bool SKIPS_BOTTOM = true;
   
-  if (!islevel) {
-    return oper;
+  static void limits(Cube& c, size_t& w, size_t& h) {
+    c.get_top_limits(w, h);
   }
   
-  // block type
-  BlockRotation b_r(s, blocks.get());
-  BlockRotation bl_r(s, blocklight.get());
-  BlockRotation sl_r(s, skylight.get());
+  static void project(Cube& c, point& p, size_t& px, size_t& py) {
+    c.project_top(p, px, py);
+  }
   
-  size_t bx;
-  size_t by;
+  static bool occludes(int bt) {
+    return false;
+  }
   
-  c.get_top_limits(bx, by);
+  static void draw(image_operations& oper, size_t px, size_t py, int bt, color top, color side) {
+    oper.add_pixel(px, py, top);
+  }
+};
 
-  oper->set_limits(bx + 1, by);
+struct oblique_projection {
+  static const bool COLUMNS = false;
+  static const bool SKIPS_BOTTOM = false;
   
-  for (int z = 0; z < mc::MapZ; z++) {
-    for (int x = 0; x < mc::MapX; x++) {
-      bool cave_initial = true;
-
-      b_r.set_xz(x, z);
-      bl_r.set_xz(x, z);
-      sl_r.set_xz(x, z);
-      
-      // do incremental color fill until color is opaque
-      for (int y = s.top; y > s.bottom; y--) {
-        int bt = b_r.get8(y);
-        
-        if (s.cavemode && cave_ignore_block(s, y, bt, b_r, cave_initial)) {
-          continue;
-        }
-        
-        if (s.excludes[bt]) {
-          continue;
-        }
-        
-        color bc = mc::MaterialColor[bt];
-        
-        apply_shading(s, bl_r.get4(y + 1), sl_r.get4(y + 1), 0, y, bc);
-        
-        point p(x, y, z);
-        
-        size_t px;
-        size_t py;
-
-        c.project_top(p, px, py);
-        
-        oper->add_pixel(px, py, bc);
-        
-        if (bc.is_opaque()) {
-          break;
-        }
-      }
-    }
+  static void limits(Cube& c, size_t& w, size_t& h) {
+    c.get_oblique_limits(w, h);
   }
   
-  if (cache_use) {
-    if (!cache.write(oper.get())) {
-      fs::remove(cache.get_path());
-    }
+  static void project(Cube& c, point& p, size_t& px, size_t& py) {
+    c.project_oblique(p, px, py);
   }
   
-  return oper;
-}
-
-boost::shared_ptr<image_operations> level_file::get_oblique_image(settings_t& s)
-{
-  if (cache_hit) return oper;
-  
-  if (!islevel) {
-    return oper;
+  static bool occludes(int bt) {
+    return true;
   }
   
-  Cube c(mc::MapX + 1, mc::MapY + 1, mc::MapZ + 1);
+  static void draw(image_operations& oper, size_t px, size_t py, int bt, color top, color side) {
+    oper.add_pixel(px, py, top);
+    oper.add_pixel(px, py + 1, side);
+  }
+};
+
+struct obliqueangle_projection {
+  static const bool COLUMNS = false;
+  static const bool SKIPS_BOTTOM = false;
   
-  // block type
-      
-  BlockRotation b_r(s, blocks.get());
-  BlockRotation bl_r(s, blocklight.get());
-  BlockRotation sl_r(s, skylight.get());
+  static void limits(Cube& c, size_t& w, size_t& h) {
+    c.get_obliqueangle_limits(w, h);
+  }
   
-  size_t bmx, bmy, bmt;
-  c.get_oblique_limits(bmx, bmy);
-  bmt = bmx * bmy;
-  bool blocked[bmt];
-  memset(blocked, 0x0, sizeof(bool) * bmt);
+  static void project(Cube& c, point& p, size_t& px, size_t& py) {
+    c.project_obliqueangle(p, px, py);
+  }
   
-  oper->set_limits(bmx + 1, bmy);
+  static bool occludes(int bt) {
+    return mc::MaterialModes[bt] == mc::Block;
+  }
   
-  for (int z = mc::MapZ - 1; z >= 0; z--) {
-    for (int x = mc::MapX - 1; x >= 0; x--) {
-      bool cave_initial = true;
+  static void draw(image_operations& oper, size_t px, size_t py, int bt, color top, color side) {
+    switch(mc::MaterialModes[bt]) {
+    case mc::Block:
+      oper.add_pixel(px, py, top);
+      oper.add_pixel(px + 1, py, top);
+      oper.add_pixel(px, py + 1, side);
       
-      b_r.set_xz(x, z);
-      bl_r.set_xz(x, z);
-      sl_r.set_xz(x, z);
-      
-      for (int y = s.top; y >= s.bottom; y--) {
-        int bt = b_r.get8(y);
-        
-        if (s.cavemode && cave_ignore_block(s, y, bt, b_r, cave_initial)) {
-          continue;
-        }
+      side.lighten(0x20);
+      oper.add_pixel(px + 1, py + 1, side);
+      break;
+    case mc::HalfBlock:
+      oper.add_pixel(px, py + 1, top);
+      oper.add_pixel(px + 1, py + 1, top);
+      break;
+    case mc::TorchBlock:
+      oper.add_pixel(px, py, top);
 
-        point p(x, y, z);
-        
-        size_t px, py;
-        c.project_oblique(p, px, py);
-        
-        color top = mc::MaterialColor[bt];
-        
-        int bp = px + bmx * py;
-        
-        if (blocked[bp]) {
-          continue;
-        }
-        
-        blocked[bp] = top.is_opaque();
-        
-        if (s.excludes[bt]) {
-          continue;
-        }
-        
-        int bl = bl_r.get4(y + 1);
-        
-        apply_shading(s, bl, sl_r.get4(y + 1), 0, y, top);
-        oper->add_pixel(px, py, top);
-        
-        color side = mc::MaterialSideColor[bt];
-        apply_shading(s, bl, -1, 0, y, side);
-        oper->add_pixel(px, py + 1, side);
-      }
+      top.lighten(0x20);
+      top.a -= 0xb0;
+      oper.add_pixel(px - 1, py, top);
+      oper.add_pixel(px + 2, py, top);
+      oper.add_pixel(px, py - 1, top);
+      oper.add_pixel(px, py + 1, top);
+      
+      oper.add_pixel(px, py + 1, side);
+      break;
     }
   }
+};
+
+struct isometric_projection {
+  static const bool COLUMNS = false;
+  static const bool SKIPS_BOTTOM = false;
   
-  if (cache_use) {
-    if (!cache.write(oper.get())) {
-      fs::remove(cache.get_path());
-    }
+  static void limits(Cube& c, size_t& w, size_t& h) {
+    c.get_isometric_limits(w, h);
   }
   
-  return oper;
-}
-boost::shared_ptr<image_operations> level_file::get_obliqueangle_image(settings_t& s)
-{
-  if (cache_hit) return oper;
+  static void project(Cube& c, point& p, size_t& px, size_t& py) {
+    c.project_isometric(p, px, py);
+  }
   
-  if (!islevel) {
-    return oper;
+  static bool occludes(int bt) {
+    return mc::MaterialModes[bt] == mc::Block;
   }
   
-  Cube c(mc::MapX + 1, mc::MapY + 1, mc::MapZ + 1);
+  static void draw(image_operations& oper, size_t px, size_t py, int bt, color top, color side) {
+    switch(mc::MaterialModes[bt]) {
+    case mc::Block:
+      oper.add_pixel(px, py, top);
+      oper.add_pixel(px + 1, py, top);
+      oper.add_pixel(px - 2, py, top);
+      oper.add_pixel(px - 1, py, top);
+      
+      oper.add_pixel(px - 2, py + 1, side);
+      oper.add_pixel(px - 1, py + 1, side);
+      
+      oper.add_pixel(px - 2, py + 2, side);
+      oper.add_pixel(px - 1, py + 2, side);
+      
+      side.lighten(0x20);
+      
+      oper.add_pixel(px, py + 1, side);
+      oper.add_pixel(px + 1, py + 1, side);
+      
+      oper.add_pixel(px, py + 2, side);
+      oper.add_pixel(px + 1, py + 2, side);
+      break;
+    case mc::HalfBlock:
+      oper.add_pixel(px, py + 1, top);
+      oper.add_pixel(px + 1, py + 1, top);
+      oper.add_pixel(px - 2, py + 1, top);
+      oper.add_pixel(px - 1, py + 1, top);
+      
+      oper.add_pixel(px - 2, py + 2, side);
+      oper.add_pixel(px - 1, py + 2, side);
+      
+      side.lighten(0x20);
+      
+      oper.add_pixel(px, py + 2, side);
+      oper.add_pixel(px + 1, py + 2, side);
+      break;
+    case mc::TorchBlock:
+      oper.add_pixel(px, py, top);
+      oper.add_pixel(px - 1, py, top);
+      
+      top.lighten(0x20);
+      top.a -= 0xb0;
+      
+      oper.add_pixel(px, py + 1, top);
+      oper.add_pixel(px - 1, py + 1, top);
+      
+      oper.add_pixel(px - 1, py + 1, side);
+      oper.add_pixel(px - 1, py + 2, side);
+      
+      side.lighten(0x20);
+      
+      oper.add_pixel(px, py + 1, side);
+      oper.add_pixel(px, py + 2, side);
+      
+      oper.add_pixel(px - 2, py, top);
+      oper.add_pixel(px + 1, py, top);
+      oper.add_pixel(px, py - 1, top);
+      oper.add_pixel(px - 1, py - 1, top);
+      break;
+    }
+  }
+};
+
+/*
+ * room to mark the pixels of the largest chunk image as covered, which is
+ * that of an isometric Anvil chunk (see Cube::get_isometric_limits)
+ */
+const size_t BLOCKED_SIZE =
+  2 * (mc::anvil_geometry::MapZ + mc::anvil_geometry::MapX + 2)
+  * (2 * (mc::anvil_geometry::MapY + 1) + mc::anvil_geometry::MapZ + mc::anvil_geometry::MapX + 2);
+
+template<typename G, typename P, unsigned int F>
+boost::shared_ptr<image_operations> level_file::render(settings_t& s)
+{
+  Cube c(G::MapX + 1, G::MapY + 1, G::MapZ + 1);
   
-  // block type
+  find_empty_sections();
+  bool skip_air = air_is_invisible(s);
+  int top_y = std::min(s.top, G::MapY - 1);
+  int bottom_y = P::SKIPS_BOTTOM ? s.bottom + 1 : s.bottom;
+  
+  BlockRotation<G> b_r(s, blocks.get(), section_blocks, mc::Air);
+  BlockRotation<G> bl_r(s, blocklight.get(), section_blocklight, 0x0);
+  BlockRotation<G> sl_r(s, skylight.get(), section_skylight, 0xf);
   
-  BlockRotation b_r(s, blocks.get());
-  BlockRotation bl_r(s, blocklight.get());
-  BlockRotation sl_r(s, skylight.get());
-  BlockRotation hm_r(s, heightmap.get());
-
   size_t bmx, bmy, bmt;
-  c.get_obliqueangle_limits(bmx, bmy);
-  bmt = bmx * bmy;
-  bool blocked[bmt];
+  P::limits(c, bmx, bmy);
+  bmt = P::COLUMNS ? 0 : bmx * bmy;
+  assert(bmt <= BLOCKED_SIZE);
+  bool blocked[BLOCKED_SIZE];
   memset(blocked, 0x0, sizeof(bool) * bmt);
   
   oper->set_limits(bmx + 1, bmy);
   
-  for (int z = mc::MapZ - 1; z >= 0; z--) {
-    for (int x = mc::MapX - 1; x >= 0; x--) {
+  for (int z = G::MapZ - 1; z >= 0; z--) {
+    for (int x = G::MapX - 1; x >= 0; x--) {
       bool cave_initial = true;
       
-      hm_r.set_xz(x, z);
       b_r.set_xz(x, z);
       bl_r.set_xz(x, z);
       sl_r.set_xz(x, z);
       
-      int hmval = hm_r.get8();
-      
-      for (int y = s.top; y >= s.bottom; y--) {
+      for (int y = top_y; y >= bottom_y; y--) {
+        if (skip_section(skip_air, empty_sections, y)) {
+          continue;
+        }
+        
         int bt = b_r.get8(y);
         
-        if (s.cavemode && cave_ignore_block(s, y, bt, b_r, cave_initial)) {
+        if ((F & CaveFeature) && cave_ignore_block(s, y, bt, b_r, cave_initial)) {
+          continue;
+        }
+        
+        // see render_features, air never covers anything so it goes first
+        if (!(F & ExcludesFeature) && bt == mc::Air) {
           continue;
         }
         
         point p(x, y, z);
         
         size_t px, py;
-        c.project_obliqueangle(p, px, py);
+        P::project(c, p, px, py);
         
         color top = mc::MaterialColor[bt];
         
-        if (mc::MaterialModes[bt] == mc::Block) {
+        if (!P::COLUMNS && P::occludes(bt)) {
           int bp = px + bmx * py;
           
           if (blocked[bp]) {
@@ -497,47 +962,32 @@ boost::shared_ptr<image_operations> level_file::get_obliqueangle_image(settings_
           blocked[bp] = top.is_opaque();
         }
         
-        if (s.excludes[bt]) {
+        if ((F & ExcludesFeature) && s.excludes[bt]) {
           continue;
         }
         
-        int bl = bl_r.get4(y + 1);
+        // the heightmap leaves no light to be seen, and the night only that
+        // of the blocks themselves
+        int bl = (F & HeightmapFeature) ? 0 : bl_r.get4(y + 1);
+        int sl = (F & (HeightmapFeature | NightFeature)) ? -1 : sl_r.get4(y + 1);
         
-        color side = mc::MaterialSideColor[bt];
+        color side;
         
-        apply_shading(s, bl, sl_r.get4(y + 1), hmval, y, top);
-        apply_shading(s, bl, -1, hmval, y, side);
+        if (!P::COLUMNS) {
+          side = mc::MaterialSideColor[bt];
+          apply_shading<F>(top_y, bl, -1, y, side);
+        }
         
-        switch(mc::MaterialModes[bt]) {
-        case mc::Block:
-          oper->add_pixel(px, py, top);
-          oper->add_pixel(px + 1, py, top);
-          oper->add_pixel(px, py + 1, side);
-          
-          side.lighten(0x20);
-          oper->add_pixel(px + 1, py + 1, side);
-          break;
-        case mc::HalfBlock:
-          oper->add_pixel(px, py + 1, top);
-          oper->add_pixel(px + 1, py + 1, top);
-          break;
-        case mc::TorchBlock:
-          oper->add_pixel(px, py, top);
-
-          top.lighten(0x20);
-          top.a -= 0xb0;
-          oper->add_pixel(px - 1, py, top);
-          oper->add_pixel(px + 2, py, top);
-          oper->add_pixel(px, py - 1, top);
-          oper->add_pixel(px, py + 1, top);
-          
-          oper->add_pixel(px, py + 1, side);
+        apply_shading<F>(top_y, bl, sl, y, top);
+        P::draw(*oper, px, py, bt, top, side);
+        
+        if (P::COLUMNS && top.is_opaque()) {
           break;
         }
       }
     }
   }
-
+  
   if (cache_use) {
     if (!cache.write(oper.get())) {
       fs::remove(cache.get_path());
@@ -547,180 +997,105 @@ boost::shared_ptr<image_operations> level_file::get_obliqueangle_image(settings_
   return oper;
 }
 
-boost::shared_ptr<image_operations> level_file::get_isometric_image(settings_t& s)
-{
+/*
+ * Picks the kernel for the features turned on, the ones from F up. Night
+ * never comes with the heightmap, which leaves those kernels out.
+ */
+template<typename G, typename P, unsigned int F>
+struct render_kernel {
+  static boost::shared_ptr<image_operations> render(level_file& level, settings_t& s, unsigned int features) {
+    if (features == F) {
+      return level.render<G, P, (F & HeightmapFeature) ? (F & ~NightFeature) : F>(s);
+    }
+    
+    return render_kernel<G, P, F + 1>::render(level, s, features);
+  }
+};
+
+template<typename G, typename P>
+struct render_kernel<G, P, AllFeatures + 1> {
+  static boost::shared_ptr<image_operations> render(level_file& level, settings_t& s, unsigned int features) {
+    return level.oper;
+  }
+};
+
+/*
+ * Anvil chunks are rendered with their full height, everything else with
+ * the height of Alpha chunks.
+ */
+template<typename P>
+boost::shared_ptr<image_operations> level_file::render(settings_t& s) {
   if (cache_hit) return oper;
   
-  Cube c(mc::MapX + 1, mc::MapY + 1, mc::MapZ + 1);
-  
-  size_t iw, ih;
-  c.get_isometric_limits(iw, ih);
-  
   if (!islevel) {
     return oper;
   }
   
-  // block type
-  BlockRotation b_r(s, blocks.get());
-  BlockRotation bl_r(s, blocklight.get());
-  BlockRotation sl_r(s, skylight.get());
-  BlockRotation hm_r(s, heightmap.get());
+  unsigned int features = render_features(s);
   
-  int bmt;
-  bmt = iw * ih;
-  bool blocked[bmt];
-  memset(blocked, 0x0, sizeof(bool) * bmt);
+  if (anvil) return render_kernel<mc::anvil_geometry, P, 0>::render(*this, s, features);
+  return render_kernel<mc::alpha_geometry, P, 0>::render(*this, s, features);
+}
 
-  oper->set_limits(iw + 1, ih);
-  
-  for (int z = mc::MapZ - 1; z >= 0; z--) {
-    for (int x = mc::MapX - 1; x >= 0; x--) {
-      bool cave_initial = true;
-      
-      hm_r.set_xz(x, z);
-      b_r.set_xz(x, z);
-      bl_r.set_xz(x, z);
-      sl_r.set_xz(x, z);
-      
-      int hmval = hm_r.get8();
-      
-      for (int y = s.top; y >= s.bottom; y--) {
-        int bt = b_r.get8(y);
-        
-        if (s.cavemode && cave_ignore_block(s, y, bt, b_r, cave_initial)) {
-          continue;
-        }
-        
-        point p(x, y, z);
-        
-        size_t px, py;
-        c.project_isometric(p, px, py);
-        
-        color top = mc::MaterialColor[bt];
-        
-        if (mc::MaterialModes[bt] == mc::Block) {
-          int bp = px + iw * py;
-          
-          if (blocked[bp]) {
-            continue;
-          }
-          
-          blocked[bp] = top.is_opaque();
-        }
-        
-        if (s.excludes[bt]) {
-          continue;
-        }
-        
-        color side = mc::MaterialSideColor[bt];
-        
-        int bl = bl_r.get4(y + 1);
-        
-        apply_shading(s, bl, sl_r.get4(y + 1), hmval, y, top);
-        apply_shading(s, bl, -1, hmval, y, side);
-        
-        switch(mc::MaterialModes[bt]) {
-        case mc::Block:
-          oper->add_pixel(px, py, top);
-          oper->add_pixel(px + 1, py, top);
-          oper->add_pixel(px - 2, py, top);
-          oper->add_pixel(px - 1, py, top);
-          
-          oper->add_pixel(px - 2, py + 1, side);
-          oper->add_pixel(px - 1, py + 1, side);
-          
-          oper->add_pixel(px - 2, py + 2, side);
-          oper->add_pixel(px - 1, py + 2, side);
-          
-          side.lighten(0x20);
-          
-          oper->add_pixel(px, py + 1, side);
-          oper->add_pixel(px + 1, py + 1, side);
-          
-          oper->add_pixel(px, py + 2, side);
-          oper->add_pixel(px + 1, py + 2, side);
-          break;
-        case mc::HalfBlock:
-          oper->add_pixel(px, py + 1, top);
-          oper->add_pixel(px + 1, py + 1, top);
-          oper->add_pixel(px - 2, py + 1, top);
-          oper->add_pixel(px - 1, py + 1, top);
-          
-          oper->add_pixel(px - 2, py + 2, side);
-          oper->add_pixel(px - 1, py + 2, side);
-          
-          side.lighten(0x20);
-          
-          oper->add_pixel(px, py + 2, side);
-          oper->add_pixel(px + 1, py + 2, side);
-          break;
-        case mc::TorchBlock:
-          oper->add_pixel(px, py, top);
-          oper->add_pixel(px - 1, py, top);
-          
-          top.lighten(0x20);
-          top.a -= 0xb0;
-          
-          oper->add_pixel(px, py + 1, top);
-          oper->add_pixel(px - 1, py + 1, top);
-          
-          oper->add_pixel(px - 1, py + 1, side);
-          oper->add_pixel(px - 1, py + 2, side);
-          
-          side.lighten(0x20);
-          
-          oper->add_pixel(px, py + 1, side);
-          oper->add_pixel(px, py + 2, side);
-          
-          oper->add_pixel(px - 2, py, top);
-          oper->add_pixel(px + 1, py, top);
-          oper->add_pixel(px, py - 1, top);
-          oper->add_pixel(px - 1, py - 1, top);
-          break;
-        }
-      }
-    }
-  }
-  
-  if (cache_use) {
-    if (!cache.write(oper.get())) {
-      fs::remove(cache.get_path());
-    }
-  }
-  
-  return oper;
+boost::shared_ptr<image_operations> level_file::get_image(settings_t& s) {
+  return render<top_projection>(s);
 }
 
-void fast_begin_compound(fast_level_file* level, nbt::String name) {
-  if (name.compare("Level") == 0) {
-    level->islevel = true;
-  }
+boost::shared_ptr<image_operations> level_file::get_oblique_image(settings_t& s) {
+  return render<oblique_projection>(s);
 }
 
-void fast_register_int(fast_level_file* level, nbt::String name, nbt::Int i) {
-  if (!level->islevel) {
-    return;
-  }
+boost::shared_ptr<image_operations> level_file::get_obliqueangle_image(settings_t& s) {
+  return render<obliqueangle_projection>(s);
+}
 
-  if (name.compare("xPos") == 0) {
-    level->has_xPos = true;
-    level->xPos = i;
+boost::shared_ptr<image_operations> level_file::get_isometric_image(settings_t& s) {
+  return render<isometric_projection>(s);
+}
+
+/*
+ * Handler picking up the chunk position, stops as soon as it is known.
+ */
+struct fast_level_handler : nbt::null_handler {
+  static const bool has_int = true;
+  
+  fast_level_file* level;
+  nbt::basic_parser<fast_level_handler>* parser;
+  
+  fast_level_handler(fast_level_file* level) : level(level), parser(NULL) {
   }
-  else if (name.compare("zPos") == 0) {
-    level->has_zPos = true;
-    level->zPos = i;
+  
+  inline void begin_compound(const nbt::Name& name) {
+    if (name == Level_key) {
+      level->islevel = true;
+    }
   }
   
-  if (level->has_xPos && level->has_zPos) {
-    level->parser.stop();
+  inline void register_int(const nbt::Name& name, nbt::Int i) {
+    if (!level->islevel) {
+      return;
+    }
+    
+    if (name == xPos_key) {
+      level->has_xPos = true;
+      level->xPos = i;
+    }
+    else if (name == zPos_key) {
+      level->has_zPos = true;
+      level->zPos = i;
+    }
+    
+    if (level->has_xPos && level->has_zPos) {
+      parser->stop();
+    }
   }
-}
-
-void fast_error_handler(fast_level_file* level, size_t where, const char *why) {
-  level->grammar_error = true;
-  level->grammar_error_where = where;
-  level->grammar_error_why = why;
-}
+  
+  inline void error_handler(size_t where, const char *why) {
+    level->grammar_error = true;
+    level->grammar_error_where = where;
+    level->grammar_error_why = why;
+  }
+};
 
 fast_level_file::fast_level_file(const fs::path path, bool force_parsing)
   :
@@ -730,8 +1105,7 @@ fast_level_file::fast_level_file(const fs::path path, bool force_parsing)
     grammar_error(false),
     grammar_error_where(0),
     grammar_error_why(""),
-    path(path),
-    parser(this)
+    path(path)
 {
   std::string extension = fs::extension(path);
   
@@ -742,9 +1116,9 @@ fast_level_file::fast_level_file(const fs::path path, bool force_parsing)
       return;
     }
 
-    parser.register_int = fast_register_int;
-    parser.begin_compound = fast_begin_compound;
-    parser.error_handler = fast_error_handler;
+    fast_level_handler handler(this);
+    nbt::basic_parser<fast_level_handler> parser(handler);
+    handler.parser = &parser;
     
     parser.parse_file(path.string().c_str());
     return;
@@ -774,3 +1148,28 @@ fast_level_file::fast_level_file(const fs::path path, bool force_parsing)
   
   islevel = true;
 }
+
+fast_level_file::fast_level_file(const region_file& region, int x, int z)
+  :
+    xPos(0), zPos(0),
+    has_xPos(false), has_zPos(false),
+    islevel(false),
+    grammar_error(false),
+    grammar_error_where(0),
+    grammar_error_why(""),
+    path(region.path)
+{
+  fast_level_handler handler(this);
+  nbt::basic_parser<fast_level_handler> parser(handler);
+  handler.parser = &parser;
+  
+  nbt::buffer& buf = nbt::thread_buffer();
+  const char *why = region.read_chunk(x, z, buf);
+  
+  if (why != NULL) {
+    handler.error_handler(0, why);
+    return;
+  }
+  
+  parser.parse_buffer(buf.data, buf.size);
+}
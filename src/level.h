@@ -24,6 +24,7 @@
 #include "blocks.h"
 #include "marker.h"
 #include "cache.h"
+#include "region.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -31,6 +32,8 @@
 
 namespace fs = boost::filesystem;
 
+template<typename G, typename P, unsigned int F> struct render_kernel;
+
 class level_file
 {
   public:
@@ -49,23 +52,105 @@ class level_file
     bool cache_hit;
     std::vector<light_marker> markers;
     
+    static const int SECTION_HEIGHT = 16;
+    static const int ANVIL_SECTIONS = 16;
+    
+    // Anvil chunks keep their blocks in sections indexed by Y, sections
+    // which are all air are left out of the file
+    bool anvil;
+    boost::scoped_ptr<nbt::ByteArray> section_blocks[ANVIL_SECTIONS];
+    boost::scoped_ptr<nbt::ByteArray> section_skylight[ANVIL_SECTIONS];
+    boost::scoped_ptr<nbt::ByteArray> section_blocklight[ANVIL_SECTIONS];
+    
+    // bit n is set when section n (counting Alpha chunks in sections too)
+    // holds nothing but air, see find_empty_sections
+    uint32_t empty_sections;
+    
+    // inflated chunk data, the byte arrays below are views into it
+    nbt::buffer* buffer;
+    
+    // the compressed chunk when it has been prefetched, and why reading it
+    // failed if it did
+    bool prefetched;
+    nbt::buffer* raw;
+    const char* raw_error;
+    
     boost::scoped_ptr<nbt::ByteArray> blocks;
     boost::scoped_ptr<nbt::ByteArray> skylight;
-    boost::scoped_ptr<nbt::ByteArray> heightmap;
     boost::scoped_ptr<nbt::ByteArray> blocklight;
     boost::shared_ptr<image_operations> oper;
     
     level_file(settings_t& s);
     ~level_file();
     
-    void load_file(const fs::path path);
+    /*
+     * use the cached operations for name if they are from mod, false if
+     * the level has to be rendered.
+     */
+    bool read_cache(const fs::path name, std::time_t mod);
+    
+    /*
+     * read the cached operations of a chunk file ahead of load_file, false
+     * if there are none and the chunk has to be read.
+     */
+    bool prefetch_cache(const fs::path path);
+    
+    /*
+     * read the chunk file (or its cached operations) ahead of load_file,
+     * which then only has to inflate and parse it.
+     */
+    void prefetch_file(const fs::path path);
+    
+    void load_file(const fs::path path, const nbt::path_query* query = NULL);
+    
+    /*
+     * the same for a chunk in a region, ahead of load_region.
+     */
+    bool prefetch_cache(const region_file& region, int x, int z);
+    void prefetch_region(const region_file& region, int x, int z);
+    
+    /*
+     * load the chunk at x, z (world chunk coordinates) out of a region.
+     */
+    void load_region(const region_file& region, int x, int z, const nbt::path_query* query = NULL);
+    
+    /*
+     * find the sections which the render loops can skip over
+     */
+    void find_empty_sections();
     
     boost::shared_ptr<image_operations> get_image(settings_t& s);
     boost::shared_ptr<image_operations> get_oblique_image(settings_t& s);
     boost::shared_ptr<image_operations> get_obliqueangle_image(settings_t& s);
     boost::shared_ptr<image_operations> get_isometric_image(settings_t& s);
+  private:
+    template<typename G, typename P, unsigned int F> friend struct render_kernel;
+    
+    /*
+     * the render kernel, specialized for the chunk geometry G (see
+     * mc::chunk_geometry), the projection P of the render mode and the
+     * features F the settings turn on (see render_features in level.cpp).
+     */
+    template<typename G, typename P, unsigned int F>
+    boost::shared_ptr<image_operations> render(settings_t& s);
+    
+    // picks the kernel for the chunk and the settings
+    template<typename P>
+    boost::shared_ptr<image_operations> render(settings_t& s);
 };
 
+/*
+ * Build the query for the parts of a chunk file that a render with these
+ * settings actually reads, for Alpha or Anvil chunks.
+ */
+void build_level_query(settings_t& s, nbt::path_query& query, bool anvil = false);
+
+/*
+ * the size of the image operations of a chunk `height' blocks high, as set
+ * up by the render kernels.
+ */
+void get_level_limits(settings_t& s, int height, size_t& w, size_t& h);
+
 class fast_level_file
 {
   public:
@@ -77,9 +162,11 @@ class fast_level_file
     size_t grammar_error_where;
     std::string grammar_error_why;
     const fs::path path;
-    nbt::Parser<fast_level_file> parser;
     
     fast_level_file(const fs::path path, bool filename);
+    
+    // parses the chunk out of a region, for a pedantic broad phase
+    fast_level_file(const region_file& region, int x, int z);
 };
 
 #endif /* _LEVEL_H_ */
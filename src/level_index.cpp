@@ -0,0 +1,245 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#include "level_index.h"
+
+#include <algorithm>
+#include <set>
+
+static inline bool entry_before(const level_index::entry& a, const level_index::entry& b) {
+  if (a.z != b.z) return a.z < b.z;
+  return a.x < b.x;
+}
+
+/*
+ * an entry and its modification time, sorted together
+ */
+struct timed_entry {
+  level_index::entry e;
+  uint32_t modified;
+  
+  bool operator<(const timed_entry& o) const {
+    return entry_before(e, o.e);
+  }
+};
+
+void level_index::add(int xReal, int zReal, boost::shared_ptr<region_file> region, std::time_t t) {
+  entry e;
+  int x = xReal, z = zReal;
+  transform_world_xz(x, z, rotation);
+  e.x = x;
+  e.z = z;
+  
+  // only chunk files have a time of their own, regions keep them
+  bool timed = !region && t != -1;
+  
+  if (region) {
+    boost::shared_ptr<region_file>& known = regions[std::make_pair(region->x, region->z)];
+    if (!known) known = region;
+  }
+  else if (timed && modified.empty()) {
+    modified.resize(entries.size(), 0);
+  }
+  
+  if (timed || !modified.empty()) {
+    modified.push_back(timed ? uint32_t(t) : 0);
+  }
+  
+  if (sorted && !entries.empty() && entry_before(e, entries.back())) {
+    sorted = false;
+  }
+  
+  entries.push_back(e);
+  
+  if (sorted) {
+    if (rows.empty() || rows.back().z != e.z) {
+      row r;
+      r.z = e.z;
+      r.begin = entries.size() - 1;
+      rows.push_back(r);
+    }
+  }
+}
+
+void level_index::sort() {
+  if (sorted) {
+    return;
+  }
+  
+  if (modified.empty()) {
+    std::stable_sort(entries.begin(), entries.end(), entry_before);
+  }
+  else {
+    std::vector<timed_entry> timed(entries.size());
+    
+    for (size_t i = 0; i < entries.size(); i++) {
+      timed[i].e = entries[i];
+      timed[i].modified = modified[i];
+    }
+    
+    std::stable_sort(timed.begin(), timed.end());
+    
+    for (size_t i = 0; i < entries.size(); i++) {
+      entries[i] = timed[i].e;
+      modified[i] = timed[i].modified;
+    }
+  }
+  
+  build_rows();
+  sorted = true;
+}
+
+void level_index::build_rows() {
+  rows.clear();
+  
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (i == 0 || entries[i].z != entries[i - 1].z) {
+      row r;
+      r.z = entries[i].z;
+      r.begin = i;
+      rows.push_back(r);
+    }
+  }
+}
+
+std::vector<level_index::row>::const_iterator level_index::find_row(int z) const {
+  // rows are few compared to chunks, a binary search over them will do
+  size_t lo = 0, hi = rows.size();
+  
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    
+    if (rows[mid].z < z) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  
+  return rows.begin() + lo;
+}
+
+uint32_t level_index::row_end(std::vector<row>::const_iterator r) const {
+  ++r;
+  return r == rows.end() ? entries.size() : r->begin;
+}
+
+level level_index::get(size_t i) const {
+  level l;
+  
+  l.xPos = entries[i].x;
+  l.zPos = entries[i].z;
+  l.xReal = l.xPos;
+  l.zReal = l.zPos;
+  
+  // the rotations are undone by rotating the rest of the way around
+  transform_world_xz(l.xReal, l.zReal, (360 - rotation) % 360);
+  
+  l.modified = -1;
+  
+  if (!regions.empty()) {
+    region_map::const_iterator it = regions.find(std::make_pair(
+      floor_div(l.xReal, region_file::WIDTH), floor_div(l.zReal, region_file::WIDTH)));
+    
+    if (it != regions.end()) {
+      l.region = it->second;
+      l.modified = l.region->get_timestamp(l.xReal, l.zReal);
+    }
+  }
+  
+  if (!modified.empty() && modified[i] != 0) {
+    l.modified = modified[i];
+  }
+  
+  return l;
+}
+
+void level_index::set_modified(size_t i, std::time_t t) {
+  if (modified.empty()) {
+    modified.resize(entries.size(), 0);
+  }
+  
+  modified[i] = t == -1 ? 0 : uint32_t(t);
+}
+
+bool level_index::find(int x, int z, size_t& i) const {
+  std::vector<row>::const_iterator r = find_row(z);
+  
+  if (r == rows.end() || r->z != z) {
+    return false;
+  }
+  
+  entry e;
+  e.x = x;
+  e.z = z;
+  
+  std::vector<entry>::const_iterator begin = entries.begin() + r->begin;
+  std::vector<entry>::const_iterator end = entries.begin() + row_end(r);
+  std::vector<entry>::const_iterator it = std::lower_bound(begin, end, e, entry_before);
+  
+  if (it == end || it->x != x) {
+    return false;
+  }
+  
+  i = it - entries.begin();
+  return true;
+}
+
+void level_index::query(int min_x, int max_x, int min_z, int max_z, std::vector<size_t>& out) const {
+  entry e;
+  
+  for (std::vector<row>::const_iterator r = find_row(min_z); r != rows.end() && r->z <= max_z; r++) {
+    e.x = min_x;
+    e.z = r->z;
+    
+    std::vector<entry>::const_iterator end = entries.begin() + row_end(r);
+    std::vector<entry>::const_iterator it = std::lower_bound(entries.begin() + r->begin, end, e, entry_before);
+    
+    for (; it != end && it->x <= max_x; it++) {
+      out.push_back(it - entries.begin());
+    }
+  }
+}
+
+void level_index::select(const std::vector<size_t>& which, level_index& out) const {
+  out.rotation = rotation;
+  out.regions = regions;
+  out.entries.clear();
+  out.modified.clear();
+  out.sorted = false;
+  
+  out.entries.reserve(which.size());
+  
+  for (std::vector<size_t>::const_iterator it = which.begin(); it != which.end(); it++) {
+    out.entries.push_back(entries[*it]);
+    
+    if (!modified.empty()) {
+      out.modified.push_back(modified[*it]);
+    }
+  }
+  
+  out.sort();
+}
+
+void level_index::remove(const std::vector<std::pair<int, int> >& positions) {
+  std::set<std::pair<int, int> > gone(positions.begin(), positions.end());
+  
+  size_t n = 0;
+  
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (gone.find(std::make_pair(int(entries[i].x), int(entries[i].z))) != gone.end()) {
+      continue;
+    }
+    
+    entries[n] = entries[i];
+    if (!modified.empty()) modified[n] = modified[i];
+    n++;
+  }
+  
+  entries.resize(n);
+  if (!modified.empty()) modified.resize(n);
+  
+  if (sorted) {
+    build_rows();
+  }
+}
@@ -0,0 +1,133 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#ifndef _LEVEL_INDEX_H_
+#define _LEVEL_INDEX_H_
+
+#include <stdint.h>
+#include <ctime>
+
+#include <vector>
+#include <map>
+
+#include <boost/shared_ptr.hpp>
+
+#include "region.h"
+
+void transform_world_xz(int& x, int& z, int rotation);
+
+/*
+ * division rounding towards negative infinity, which is how chunks are
+ * grouped into regions and parts
+ */
+inline int floor_div(int a, int b) {
+  int q = a / b;
+  if (a % b < 0) --q;
+  return q;
+}
+
+struct level {
+  int xPos, zPos;
+  int xReal, zReal;
+  // the region holding the chunk, empty for c.<x>.<z>.dat chunk files
+  boost::shared_ptr<region_file> region;
+  // modification time if the broad phase found it out, otherwise -1
+  std::time_t modified;
+};
+
+/**
+ * The chunks of a world, as a flat array of packed positions sorted in the
+ * order they are rendered in (by z, then by x).
+ *
+ * A chunk only takes the 8 bytes of its position. Real positions follow
+ * from the rotation, regions are looked up by the position of the chunk,
+ * and modification times are only kept for chunk files (4 more bytes) since
+ * regions have them in their header.
+ *
+ * Positions are the rotated xPos/zPos of a level throughout, ranges are
+ * inclusive.
+ */
+class level_index {
+public:
+  struct entry {
+    int32_t x, z;
+  };
+private:
+  // start of every row of chunks sharing the same z
+  struct row {
+    int32_t z;
+    uint32_t begin;
+  };
+  
+  typedef std::map<std::pair<int, int>, boost::shared_ptr<region_file> > region_map;
+  
+  int rotation;
+  std::vector<entry> entries;
+  // either empty or one per entry, 0 when unknown
+  std::vector<uint32_t> modified;
+  std::vector<row> rows;
+  region_map regions;
+  bool sorted;
+  
+  void build_rows();
+  std::vector<row>::const_iterator find_row(int z) const;
+  uint32_t row_end(std::vector<row>::const_iterator r) const;
+public:
+  level_index(int rotation = 0) : rotation(rotation), sorted(true) {}
+  
+  /*
+   * add a chunk by its real position, sort() has to be called before the
+   * index is used again.
+   */
+  void add(int xReal, int zReal, boost::shared_ptr<region_file> region, std::time_t modified);
+  
+  /*
+   * sort the chunks added since the last call into render order, chunks
+   * added more than once are kept in the order they were added.
+   */
+  void sort();
+  
+  size_t size() const {
+    return entries.size();
+  }
+  
+  bool empty() const {
+    return entries.empty();
+  }
+  
+  const entry& operator[](size_t i) const {
+    return entries[i];
+  }
+  
+  /*
+   * everything known about the i:th chunk in render order.
+   */
+  level get(size_t i) const;
+  
+  /*
+   * the modification time of a chunk file is known to have changed.
+   */
+  void set_modified(size_t i, std::time_t t);
+  
+  /*
+   * find the chunk at a position, neighbours are found by asking for the
+   * position next to a chunk.
+   */
+  bool find(int x, int z, size_t& i) const;
+  
+  /*
+   * add every chunk within a range of positions to `out', in render order.
+   */
+  void query(int min_x, int max_x, int min_z, int max_z, std::vector<size_t>& out) const;
+  
+  /*
+   * an index of some of the chunks of this one, by their index here.
+   */
+  void select(const std::vector<size_t>& which, level_index& out) const;
+  
+  /*
+   * drop every chunk at the given positions.
+   */
+  void remove(const std::vector<std::pair<int, int> >& positions);
+};
+
+#endif /* _LEVEL_INDEX_H_ */
@@ -2,6 +2,7 @@
 // (C) Copyright 2010 John-John Tedro et al.
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <getopt.h>
 
 #include <errno.h>
@@ -9,9 +10,12 @@
 #include <sstream>
 #include <string>
 #include <list>
+#include <set>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <queue>
+#include <functional>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/ptr_container/ptr_list.hpp>
@@ -24,6 +28,10 @@
 #include "config.h"
 
 #include "threads/threadworker.h"
+#include "threads/wavefront.h"
+#if !defined(C10T_DISABLE_THREADS)
+#  include "threads/bounded_queue.h"
+#endif
 #include "2d/cube.h"
 
 #include "global.h"
@@ -37,6 +45,9 @@
 #include "marker.h"
 #include "json.h"
 #include "warps.h"
+#include "canvas.h"
+#include "watcher.h"
+#include "async_reader.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
@@ -125,6 +136,8 @@ inline void cout_end() {
  */
 struct render_result {
   int xPos, zPos;
+  // of the level in world_info::levels
+  size_t index;
   fs::path path;
   boost::shared_ptr<level_file> level;
   
@@ -133,21 +146,52 @@ struct render_result {
 
 struct render_job {
   int xPos, zPos;
+  size_t index;
   fs::path path;
   boost::shared_ptr<level_file> level;
+  // set for chunks in region files, which are found at xReal, zReal
+  boost::shared_ptr<region_file> region;
+  int xReal, zReal;
+  // see level_wave
+  size_t wave;
 };
 
+inline void calc_image_partial(settings_t& s, render_result &p, image_base *all, world_info &world, const dirty_grid* dirty);
+inline void calc_image_partial(settings_t& s, render_result &p, depth_image *depth, world_info &world, const dirty_grid* dirty);
+
 class Renderer : public threadworker<render_job, render_result> {
 public:
   settings_t& s;
-  
-  Renderer(settings_t& s, int n) : threadworker<render_job, render_result>(n), s(s) {
+  nbt::path_query query;
+  nbt::path_query anvil_query;
+  
+  // set when the threads composite their results into the image themselves,
+  // which only works for chunks that never draw over each other and an
+  // image in memory
+  image_base* direct;
+  // or through a depth plane, for chunks that do draw over each other
+  depth_image* depth;
+  // set when chunks that draw over each other go into direct a wave at a time
+  wavefront* waves;
+  world_info* world;
+  const dirty_grid* dirty;
+  
+  Renderer(settings_t& s, int n, bool ordered) :
+    threadworker<render_job, render_result>(n, ordered), s(s), direct(NULL), depth(NULL), waves(NULL), world(NULL), dirty(NULL)
+  {
+    build_level_query(s, query);
+    build_level_query(s, anvil_query, true);
   }
   
-  render_result work(render_job job) {
+  render_result render(render_job& job) {
     level_file* level = job.level.get();
     
-    level->load_file(job.path);
+    if (job.region) {
+      level->load_region(*job.region, job.xReal, job.zReal, job.region->anvil ? &anvil_query : &query);
+    }
+    else {
+      level->load_file(job.path, &query);
+    }
     
     render_result p;
     
@@ -155,6 +199,7 @@ public:
     p.level = job.level;
     p.xPos = job.xPos;
     p.zPos = job.zPos;
+    p.index = job.index;
     
     if (level->grammar_error) {
       return p;
@@ -173,13 +218,395 @@ public:
     
     return p;
   }
+  
+  render_result work(render_job job) {
+    render_result p = render(job);
+    
+    if (p.operations && direct != NULL) {
+      if (waves == NULL || waves->wait(job.wave)) {
+        calc_image_partial(s, p, direct, *world, dirty);
+      }
+      
+      p.operations.reset();
+    }
+    else if (p.operations && depth != NULL) {
+      calc_image_partial(s, p, depth, *world, dirty);
+      p.operations.reset();
+    }
+    
+    if (waves != NULL) {
+      waves->done(job.wave);
+    }
+    
+    return p;
+  }
+};
+
+/*
+ * The I/O stage in front of the Renderer, reading the chunks (or their
+ * cached operations) of levels ahead of the render threads, which take them
+ * through a bounded queue in the order of levels if it is ordered.
+ *
+ * The reads are kept in flight through io_uring by a single thread where
+ * the kernel has it, and otherwise done by a pool of threads. Without any
+ * threads the chunks are taken out as they are to be read by the render
+ * threads, and the kernel is told about the ones coming up so that it can
+ * read them in meanwhile.
+ *
+ * With an io_order other than the order of levels, the threads take the
+ * chunks of the next io_window levels in the order they are on the disk,
+ * sweeping over it like an elevator instead of seeking back and forth. The
+ * queue holds as many, so that it always has room for the first chunk not
+ * yet read and the render threads never wait on a chunk that isn't being
+ * read.
+ */
+class Reader {
+private:
+  settings_t& s;
+  world_info& world;
+  const std::vector<size_t>& levels;
+  // the next of levels to read, and to let the kernel know about
+  size_t next;
+  size_t advised;
+  
+  // levels before next not yet read, by where on the disk they are, and
+  // where the last chunk read was
+  typedef std::pair<uint64_t, uint64_t> position;
+  std::set<std::pair<position, size_t> > window;
+  std::set<size_t> unread;
+  position head;
+  
+# if !defined(C10T_DISABLE_THREADS)
+    bounded_queue<render_job> loaded;
+    boost::mutex next_mutex;
+    std::list<boost::thread*> threads;
+    boost::scoped_ptr<async_reader> ring;
+# endif
+  
+  render_job make_job(size_t i) {
+    level l = world.levels.get(levels[i]);
+    
+    render_job job;
+    job.level.reset(new level_file(s));
+    job.path = world.get_level_path(l);
+    job.xPos = l.xPos;
+    job.zPos = l.zPos;
+    job.index = levels[i];
+    job.region = l.region;
+    job.xReal = l.xReal;
+    job.zReal = l.zReal;
+    job.wave = 0;
+    return job;
+  }
+  
+  position find_position(size_t i) {
+    level l = world.levels.get(levels[i]);
+    
+    fs::path path = world.get_level_path(l);
+    size_t offset = 0, length;
+    
+    if (l.region) {
+      if (l.region->locate_chunk(l.xReal, l.zReal, offset, length) != NULL) {
+        return position(0, 0);
+      }
+      
+      path = l.region->path;
+    }
+    
+    position p;
+    
+    // anything the file system can't place is read first, in level order
+    if (!disk_position(path.string().c_str(), offset, s.io_order == ExtentIoOrder, p.first, p.second)) {
+      return position(0, 0);
+    }
+    
+    return p;
+  }
+  
+  /*
+   * pick the next of levels to read, false if there are none left.
+   */
+  bool take(size_t& i) {
+    if (s.io_order == LevelIoOrder) {
+      if (next >= levels.size()) {
+        return false;
+      }
+      
+      i = next++;
+      return true;
+    }
+    
+    size_t first = unread.empty() ? next : *unread.begin();
+    
+    for (; next < levels.size() && next < first + s.io_window; next++) {
+      window.insert(std::make_pair(find_position(next), next));
+      unread.insert(next);
+    }
+    
+    if (window.empty()) {
+      return false;
+    }
+    
+    // on from the last chunk read, or around to the start of the disk
+    std::set<std::pair<position, size_t> >::iterator it = window.lower_bound(std::make_pair(head, size_t(0)));
+    
+    if (it == window.end()) {
+      it = window.begin();
+    }
+    
+    head = it->first;
+    i = it->second;
+    window.erase(it);
+    unread.erase(i);
+    return true;
+  }
+  
+  void advise(size_t i) {
+    level l = world.levels.get(levels[i]);
+    
+    if (l.region) {
+      l.region->will_need(l.xReal, l.zReal);
+    }
+    else {
+      advise_will_need(world.get_level_path(l).string().c_str());
+    }
+  }
+  
+# if !defined(C10T_DISABLE_THREADS)
+  void run() {
+    while (true) {
+      size_t i;
+      
+      {
+        boost::mutex::scoped_lock lock(next_mutex);
+        
+        if (!take(i)) {
+          return;
+        }
+      }
+      
+      render_job job = make_job(i);
+      
+      if (job.region) {
+        job.level->prefetch_region(*job.region, job.xReal, job.zReal);
+      }
+      else {
+        job.level->prefetch_file(job.path);
+      }
+      
+      if (!loaded.push(i, job)) {
+        return;
+      }
+    }
+  }
+  
+  /*
+   * start reading the chunk of job i on the ring, false if it needs no
+   * reading or couldn't be read (which the render thread finds out about).
+   */
+  bool submit(size_t i, render_job& job) {
+    level_file& level = *job.level;
+    const char *why;
+    
+    if (job.region) {
+      if (level.prefetch_cache(*job.region, job.xReal, job.zReal)) {
+        return false;
+      }
+      
+      level.raw = nbt::acquire_buffer();
+      
+      size_t offset, length;
+      
+      why = job.region->locate_chunk(job.xReal, job.zReal, offset, length);
+      
+      if (why == NULL) {
+        why = ring->submit(i, job.region->path.string().c_str(), *level.raw, offset, length);
+      }
+    }
+    else {
+      if (level.prefetch_cache(job.path)) {
+        return false;
+      }
+      
+      level.raw = nbt::acquire_buffer();
+      why = ring->submit(i, job.path.string().c_str(), *level.raw);
+    }
+    
+    level.raw_error = why;
+    return why == NULL;
+  }
+  
+  void run_ring() {
+    // chunks being read, and the ones read which didn't fit in the queue
+    std::map<size_t, render_job> reading;
+    std::map<size_t, render_job> ready;
+    // buffers of reads lost with the ring, which the kernel may still write
+    std::vector<nbt::buffer*> abandoned;
+    
+    while (!loaded.is_closed()) {
+      while (!ready.empty() && loaded.push(ready.begin()->first, ready.begin()->second, false)) {
+        ready.erase(ready.begin());
+      }
+      
+      size_t i;
+      
+      while (reading.size() + ready.size() < s.io_depth && take(i)) {
+        render_job job = make_job(i);
+        
+        if (submit(i, job)) {
+          reading[i] = job;
+        }
+        else {
+          ready[i] = job;
+        }
+      }
+      
+      if (reading.empty()) {
+        if (ready.empty()) {
+          break;
+        }
+        
+        // nothing left to wait for but room in the queue
+        if (loaded.push(ready.begin()->first, ready.begin()->second)) {
+          ready.erase(ready.begin());
+        }
+        
+        continue;
+      }
+      
+      size_t id;
+      const char *why;
+      
+      if (!ring->complete(id, why)) {
+        // the ring is given up on, what was in flight is read again on the
+        // render threads
+        for (std::map<size_t, render_job>::iterator it = reading.begin(); it != reading.end(); it++) {
+          abandoned.push_back(it->second.level->raw);
+          it->second.level->raw = NULL;
+          it->second.level->prefetched = false;
+          ready.insert(*it);
+        }
+        
+        reading.clear();
+        break;
+      }
+      
+      std::map<size_t, render_job>::iterator it = reading.find(id);
+      
+      if (it == reading.end()) {
+        continue;
+      }
+      
+      it->second.level->raw_error = why;
+      ready.insert(*it);
+      reading.erase(it);
+    }
+    
+    if (!abandoned.empty()) {
+      if (s.debug) {
+        cout << "Stopped reading through io_uring: " << ring->error << endl;
+      }
+      
+      // the rest is read the way the I/O threads do without a ring
+      for (; !ready.empty() && loaded.push(ready.begin()->first, ready.begin()->second); ready.erase(ready.begin())) {
+      }
+      
+      if (ready.empty()) {
+        run();
+      }
+    }
+    
+    // abandoned, but the buffers can't be let go before the kernel is done
+    size_t id;
+    const char *why;
+    
+    while (ring->complete(id, why)) {
+    }
+    
+    // unless the kernel can't be asked any more
+    if (ring->in_flight() == 0) {
+      for (size_t i = 0; i < abandoned.size(); i++) {
+        nbt::release_buffer(abandoned[i]);
+      }
+    }
+  }
+# endif
+public:
+  Reader(settings_t& s, world_info& world, const std::vector<size_t>& levels, size_t capacity, bool ordered) :
+    s(s), world(world), levels(levels), next(0), advised(0), head(0, 0)
+#   if !defined(C10T_DISABLE_THREADS)
+      , loaded(s.io_order != LevelIoOrder ? std::max(capacity, size_t(s.io_window)) : capacity, ordered)
+#   endif
+  {
+#   if !defined(C10T_DISABLE_THREADS)
+      if (s.io_threads > 0 && s.io_depth > 0) {
+        ring.reset(new async_reader(s.io_depth));
+        
+        if (ring->is_open()) {
+          threads.push_back(new boost::thread(boost::bind(&Reader::run_ring, this)));
+          return;
+        }
+        
+        if (s.debug) {
+          cout << "Not reading through io_uring: " << ring->error << endl;
+        }
+        
+        ring.reset();
+      }
+      
+      for (unsigned int i = 0; i < s.io_threads; i++) {
+        threads.push_back(new boost::thread(boost::bind(&Reader::run, this)));
+      }
+#   endif
+  }
+  
+  ~Reader() {
+    stop();
+  }
+  
+  /*
+   * the next chunk to render, without waiting for it to be read unless wait
+   * is set. False if there is none.
+   */
+  bool pop(render_job& job, bool wait) {
+#   if !defined(C10T_DISABLE_THREADS)
+      if (!threads.empty()) {
+        return loaded.pop(job, wait);
+      }
+#   endif
+    
+    if (next >= levels.size()) {
+      return false;
+    }
+    
+    for (advised = std::max(advised, next); advised < std::min(next + s.io_depth, levels.size()); advised++) {
+      advise(advised);
+    }
+    
+    job = make_job(next++);
+    return true;
+  }
+  
+  // abandon whatever is left to read
+  void stop() {
+#   if !defined(C10T_DISABLE_THREADS)
+      loaded.close();
+      
+      for (std::list<boost::thread*>::iterator it = threads.begin(); it != threads.end(); it++) {
+        (*it)->join();
+        delete *it;
+      }
+      
+      threads.clear();
+#   endif
+  }
 };
 
 inline void calc_image_width_height(settings_t& s, world_info& world, size_t &image_width, size_t &image_height) {
   int diffx = world.max_x - world.min_x;
   int diffz = world.max_z - world.min_z;
   
-  Cube c((diffx + 1) * mc::MapX, mc::MapY, (diffz + 1) * mc::MapZ);
+  Cube c((diffx + 1) * mc::MapX, world.height, (diffz + 1) * mc::MapZ);
   
   switch (s.mode) {
   case Top:
@@ -198,39 +625,294 @@ inline void calc_image_width_height(settings_t& s, world_info& world, size_t &im
   }
 }
 
-inline void calc_image_partial(settings_t& s, render_result &p, image_base *all, world_info &world, int image_width, int image_height) {
-  size_t diffx = world.max_x - world.min_x;
-  size_t diffz = world.max_z - world.min_z;
-
-  size_t posx = p.xPos - world.min_x;
-  size_t posz = p.zPos - world.min_z;
-  
-  Cube c(diffx * mc::MapX, mc::MapY, diffz * mc::MapZ);
-  size_t x, y;
+/*
+ * where the image operations of the chunk at xPos, zPos are put in the image
+ */
+inline void calc_level_position(settings_t& s, world_info &world, int xPos, int zPos, int &image_x, int &image_y) {
+  size_t diffx = world.max_x - world.min_x;
+  size_t diffz = world.max_z - world.min_z;
+
+  size_t posx = xPos - world.min_x;
+  size_t posz = zPos - world.min_z;
+  
+  Cube c(diffx * mc::MapX, world.height, diffz * mc::MapZ);
+  size_t x = 0, y = 0;
+  
+  point pos(posx * mc::MapX, world.height, posz * mc::MapZ);
+  
+  switch (s.mode) {
+    case Top:           c.project_top(pos, x, y);           break;
+    case Oblique:       c.project_oblique(pos, x, y);       break;
+    case ObliqueAngle:  c.project_obliqueangle(pos, x, y);  break;
+    case Isometric:     c.project_isometric(pos, x, y);     break;
+  }
+  
+  /*std::cout << "diff-xy: " << diffx << " " << diffz << std::endl;
+  std::cout << "pos-xy: " << posx << " " << posz << std::endl;
+  std::cout << "xy: " << x << " " << y << std::endl;*/
+  
+  image_x = x;
+  image_y = y;
+}
+
+/*
+ * mark the part of the image that the chunk at xPos, zPos draws on
+ */
+inline void mark_level(settings_t& s, world_info &world, int xPos, int zPos, dirty_grid& dirty) {
+  int x, y;
+  size_t w, h;
+  
+  calc_level_position(s, world, xPos, zPos, x, y);
+  get_level_limits(s, world.height, w, h);
+  dirty.mark(x, y, w, h);
+}
+
+inline bool level_is_dirty(settings_t& s, world_info &world, int xPos, int zPos, dirty_grid& dirty) {
+  int x, y;
+  size_t w, h;
+  
+  calc_level_position(s, world, xPos, zPos, x, y);
+  get_level_limits(s, world.height, w, h);
+  return dirty.intersects(x, y, w, h);
+}
+
+/*
+ * whether chunks may draw over each other, so that they have to be
+ * composited in order. From the top every chunk has a 16x16 square of its
+ * own, even though get_level_limits leaves some room around it.
+ */
+inline bool levels_overlap(settings_t& s) {
+  return s.mode != Top;
+}
+
+/*
+ * whether chunks that draw over each other can be composited a wave at a
+ * time, which takes waves of chunks that never share a pixel.
+ *
+ * Oblique angle chunks lie MapX + MapZ pixels apart along a diagonal, but
+ * torches draw a pixel to the left and two to the right of that, so the
+ * neighbours on it share pixels and have to be composited in order.
+ */
+inline bool levels_have_waves(settings_t& s) {
+  return s.mode == Oblique || s.mode == Isometric;
+}
+
+/*
+ * the wave the chunk at xPos, zPos is composited in, see levels_have_waves.
+ *
+ * Isometric chunks lie along a diagonal, which the projection moves exactly
+ * as far to the side as a chunk draws (2 * (MapX + MapZ) pixels, torches
+ * included), and oblique ones along a column MapZ pixels apart. Whatever a
+ * chunk draws over comes before it in row order and is in an earlier wave.
+ */
+inline int level_wave(settings_t& s, int xPos, int zPos) {
+  if (s.mode == Oblique) {
+    return xPos;
+  }
+  
+  return xPos + zPos;
+}
+
+struct compare_level_waves {
+  settings_t& s;
+  const level_index& index;
+  
+  compare_level_waves(settings_t& s, const level_index& index) : s(s), index(index) {
+  }
+  
+  bool operator()(size_t a, size_t b) const {
+    return level_wave(s, index[a].x, index[a].z) < level_wave(s, index[b].x, index[b].z);
+  }
+};
+
+inline bool compare_level_markers(const std::pair<size_t, light_marker>& a, const std::pair<size_t, light_marker>& b) {
+  return a.first < b.first;
+}
+
+// size of the image tiles walked through by TileOrder, in pixels
+const int JOB_TILE = 256;
+
+/*
+ * a job that may be handed to the renderer, by its place in the job order
+ */
+struct ready_job {
+  uint64_t key;
+  size_t index;
+  
+  bool operator>(const ready_job& o) const {
+    if (key != o.key) return key > o.key;
+    return index > o.index;
+  }
+};
+
+inline uint64_t morton_key(uint32_t x, uint32_t z) {
+  uint64_t key = 0;
+  
+  for (int b = 0; b < 32; b++) {
+    key |= uint64_t((x >> b) & 1) << (2 * b);
+    key |= uint64_t((z >> b) & 1) << (2 * b + 1);
+  }
+  
+  return key;
+}
+
+/*
+ * reorder the levels to render (indexes into world.levels, in render order)
+ * so that consecutive composites land close to each other in the image.
+ *
+ * Levels that draw on the same part of the image are still composited in
+ * render order if overlap is set, which keeps the image the same as with
+ * RowOrder. The order
+ * is a topological sort of that constraint, picking whatever is ready and
+ * first in morton or image tile order.
+ */
+inline void order_levels(settings_t& s, world_info& world, std::vector<size_t>& levels, bool overlap) {
+  if (s.job_order == RowOrder || levels.size() < 2) {
+    return;
+  }
+  
+  const level_index& index = world.levels;
+  
+  // offsets to every level that may draw on the same part of the image
+  std::vector<std::pair<int, int> > overlaps;
+  
+  {
+    int x0, y0;
+    size_t w, h;
+    
+    calc_level_position(s, world, world.min_x, world.min_z, x0, y0);
+    get_level_limits(s, world.height, w, h);
+    
+    int reach = std::max(w, h) / std::min(mc::MapX, mc::MapZ) + 1;
+    
+    for (int dz = -reach; dz <= reach; dz++) {
+      for (int dx = -reach; dx <= reach; dx++) {
+        if (!overlap && (dx != 0 || dz != 0)) {
+          continue;
+        }
+        
+        int x1, y1;
+        calc_level_position(s, world, world.min_x + dx, world.min_z + dz, x1, y1);
+        
+        if (std::abs(x1 - x0) < int(w) && std::abs(y1 - y0) < int(h)) {
+          overlaps.push_back(std::make_pair(dx, dz));
+        }
+      }
+    }
+  }
+  
+  // the job of every level, -1 for the ones not being rendered
+  std::vector<int32_t> jobs(index.size(), -1);
+  
+  for (size_t j = 0; j < levels.size(); j++) {
+    jobs[levels[j]] = j;
+  }
+  
+  // number of levels that have to be composited before each job
+  std::vector<uint32_t> waiting(levels.size(), 0);
+  std::vector<ready_job> keys(levels.size());
+  
+  for (size_t j = 0; j < levels.size(); j++) {
+    const level_index::entry& e = index[levels[j]];
+    
+    keys[j].index = levels[j];
+    
+    if (s.job_order == MortonOrder) {
+      keys[j].key = morton_key(e.x - world.min_x, e.z - world.min_z);
+    }
+    else {
+      int x, y;
+      calc_level_position(s, world, e.x, e.z, x, y);
+      keys[j].key = (uint64_t(std::max(y, 0) / JOB_TILE) << 32) | uint64_t(std::max(x, 0) / JOB_TILE);
+    }
+    
+    for (std::vector<std::pair<int, int> >::iterator o = overlaps.begin(); o != overlaps.end(); o++) {
+      int x = e.x + o->first, z = e.z + o->second;
+      size_t i;
+      
+      if (!index.find(x, z, i)) {
+        continue;
+      }
+      
+      // levels sharing a position are found as well
+      for (; i < levels[j] && index[i].x == x && index[i].z == z; i++) {
+        if (jobs[i] != -1) waiting[j]++;
+      }
+    }
+  }
+  
+  std::priority_queue<ready_job, std::vector<ready_job>, std::greater<ready_job> > ready;
+  
+  for (size_t j = 0; j < levels.size(); j++) {
+    if (waiting[j] == 0) ready.push(keys[j]);
+  }
+  
+  size_t n = 0;
+  
+  while (!ready.empty()) {
+    size_t current = ready.top().index;
+    ready.pop();
+    
+    levels[n++] = current;
+    
+    const level_index::entry& e = index[current];
+    
+    for (std::vector<std::pair<int, int> >::iterator o = overlaps.begin(); o != overlaps.end(); o++) {
+      int x = e.x + o->first, z = e.z + o->second;
+      size_t i;
+      
+      if (!index.find(x, z, i)) {
+        continue;
+      }
+      
+      for (; i < index.size() && index[i].x == x && index[i].z == z; i++) {
+        if (i <= current || jobs[i] == -1) {
+          continue;
+        }
+        
+        if (--waiting[jobs[i]] == 0) {
+          ready.push(keys[jobs[i]]);
+        }
+      }
+    }
+  }
+}
+
+/*
+ * composite a chunk into the image, only on the dirty parts of it if dirty
+ * is set.
+ */
+inline void calc_image_partial(settings_t& s, render_result &p, image_base *all, world_info &world, const dirty_grid* dirty) {
+  int x, y;
   
-  point pos(posx * mc::MapX, mc::MapY, posz * mc::MapZ);
+  calc_level_position(s, world, p.xPos, p.zPos, x, y);
   
-  switch (s.mode) {
-    case Top:           c.project_top(pos, x, y);           break;
-    case Oblique:       c.project_oblique(pos, x, y);       break;
-    case ObliqueAngle:  c.project_obliqueangle(pos, x, y);  break;
-    case Isometric:     c.project_isometric(pos, x, y);     break;
+  if (dirty != NULL) {
+    all->composite(x, y, *p.operations, *dirty);
+    return;
   }
   
-  /*std::cout << "diff-xy: " << diffx << " " << diffz << std::endl;
-  std::cout << "pos-xy: " << posx << " " << posz << std::endl;
-  std::cout << "xy: " << x << " " << y << std::endl;*/
-  
   all->composite(x, y, *p.operations);
 }
 
+/*
+ * the same through a depth plane, in whatever order the chunks come in
+ */
+inline void calc_image_partial(settings_t& s, render_result &p, depth_image *depth, world_info &world, const dirty_grid* dirty) {
+  int x, y;
+  
+  calc_level_position(s, world, p.xPos, p.zPos, x, y);
+  
+  depth->composite(x, y, p.index, *p.operations, dirty);
+}
+
 inline void write_markers(settings_t& s, image_base *all, world_info &world, boost::ptr_vector<marker>& markers) {
   int diffx = (world.max_x - world.min_x) * mc::MapX;
   int diffz = (world.max_z - world.min_z) * mc::MapZ;
   int min_z = world.min_z * mc::MapZ;
   int min_x = world.min_x * mc::MapX;
   
-  Cube c(diffx + mc::MapX, mc::MapY, diffz + mc::MapZ);
+  Cube c(diffx + mc::MapX, world.height, diffz + mc::MapZ);
   
   boost::ptr_vector<marker>::iterator it;
 
@@ -245,7 +927,7 @@ inline void write_markers(settings_t& s, image_base *all, world_info &world, boo
     
     point pos(p_x - min_x, p_y, p_z - min_z);
 
-    size_t x, y;
+    size_t x = 0, y = 0;
     
     switch (s.mode) {
       case Top:           c.project_top(pos, x, y);           break;
@@ -282,7 +964,7 @@ inline void overlay_markers(settings_t& s, image_base *all, world_info &world, b
   int min_z = world.min_z * mc::MapZ;
   int min_x = world.min_x * mc::MapX;
   
-  Cube c(diffx + mc::MapX, mc::MapY, diffz + mc::MapZ);
+  Cube c(diffx + mc::MapX, world.height, diffz + mc::MapZ);
   
   memory_image positionmark(5, 5);
   positionmark.fill(s.ttf_color);
@@ -297,7 +979,7 @@ inline void overlay_markers(settings_t& s, image_base *all, world_info &world, b
     transform_world_xz(p_x, p_z, s.rotation);
     point pos(p_x - min_x, p_y, p_z - min_z);
 
-    size_t x, y;
+    size_t x = 0, y = 0;
     
     switch (s.mode) {
       case Top:           c.project_top(pos, x, y);           break;
@@ -311,7 +993,43 @@ inline void overlay_markers(settings_t& s, image_base *all, world_info &world, b
   }
 }
 
-bool do_one_world(settings_t &s, world_info& world, players_db& pdb, warps_db& wdb, const string& output) {
+/*
+ * what a watching render keeps between passes over the same world, so
+ * that the canvas isn't read back from the cache directory every time
+ */
+struct resident_canvas {
+  memory_image* image;
+  boost::scoped_ptr<canvas_state> canvas;
+  // levels known to have changed, whatever their modification time says
+  std::set<std::pair<int, int> > changed;
+  
+  resident_canvas() : image(NULL) {}
+  
+  ~resident_canvas() {
+    delete image;
+  }
+};
+
+/*
+ * hand the image and canvas of a render to the next pass, or get rid of them
+ */
+inline void release_image(image_base *all, boost::scoped_ptr<canvas_state>& canvas, resident_canvas* resident, bool keep) {
+  if (resident != NULL) {
+    delete resident->image;
+    resident->image = NULL;
+    resident->canvas.reset();
+  }
+  
+  if (!keep) {
+    delete all;
+    return;
+  }
+  
+  resident->image = static_cast<memory_image*>(all);
+  resident->canvas.swap(canvas);
+}
+
+bool do_one_world(settings_t &s, world_info& world, players_db& pdb, warps_db& wdb, const string& output, resident_canvas* resident = NULL) {
   if (s.debug) {
     cout << "world_info" << endl;
     cout << "  min_x: " << world.min_x << endl;
@@ -354,6 +1072,7 @@ bool do_one_world(settings_t &s, world_info& world, players_db& pdb, warps_db& w
   }
   
   image_base *all;
+  bool reused = false;
   
   if (mem_x > s.memory_limit) {
     try {
@@ -365,95 +1084,310 @@ bool do_one_world(settings_t &s, world_info& world, players_db& pdb, warps_db& w
       return false;
     }
   }
+  else if (resident != NULL && resident->image != NULL && resident->canvas
+      && resident->image->get_width() == i_w && resident->image->get_height() == i_h) {
+    all = resident->image;
+    resident->image = NULL;
+    reused = true;
+  }
   else {
     all = new memory_image(i_w, i_h);
   }
   
-  Renderer renderer(s, s.threads);
-  renderer.start();
-  unsigned int world_size = world.levels.size();
+  // an incremental render picks up the image of the previous run, which has
+  // to be held in memory
+  boost::scoped_ptr<canvas_state> canvas;
+  boost::scoped_ptr<dirty_grid> dirty;
+  // the levels to render, by their index in world.levels
+  std::vector<size_t> levels;
+  bool all_levels = true;
   
-  std::list<level>::iterator lvlit = world.levels.begin();
-  
-  unsigned int lvlq = 0;
-  unsigned int i;
-
-  std::vector<light_marker> light_markers;
+  if (s.incremental && mem_x <= s.memory_limit) {
+    memory_image* canvas_image = static_cast<memory_image*>(all);
+    
+    if (reused) {
+      canvas.swap(resident->canvas);
+    }
+    else {
+      stringstream name;
+      name << "canvas." << world.chunk_x << "." << world.chunk_y;
+      canvas.reset(new canvas_state(s.cache_dir / name.str()));
+    }
+    
+    canvas_state::chunk_map chunks;
+    
+    for (size_t i = 0; i < world.levels.size(); i++) {
+      level l = world.levels.get(i);
+      chunks[std::make_pair(l.xPos, l.zPos)] = world.get_level_modified(l);
+    }
+    
+    bool previous =
+      (reused || canvas->read_chunks())
+      && canvas->width == i_w && canvas->height == i_h
+      && canvas->min_x == world.min_x && canvas->min_z == world.min_z
+      && canvas->max_x == world.max_x && canvas->max_z == world.max_z
+      && (reused || canvas->read_pixels(*canvas_image));
+    
+    if (previous) {
+      dirty.reset(new dirty_grid(i_w, i_h));
+      
+      canvas_state::chunk_map::iterator it;
+      
+      // chunks which are new, changed or removed since the previous run
+      for (it = chunks.begin(); it != chunks.end(); it++) {
+        canvas_state::chunk_map::iterator prev = canvas->chunks.find(it->first);
+        
+        if (prev == canvas->chunks.end() || prev->second != it->second || it->second == -1) {
+          mark_level(s, world, it->first.first, it->first.second, *dirty);
+        }
+      }
+      
+      if (resident != NULL) {
+        std::set<std::pair<int, int> >::iterator c;
+        
+        for (c = resident->changed.begin(); c != resident->changed.end(); c++) {
+          mark_level(s, world, c->first, c->second, *dirty);
+        }
+      }
+      
+      for (it = canvas->chunks.begin(); it != canvas->chunks.end(); it++) {
+        if (chunks.find(it->first) == chunks.end()) {
+          mark_level(s, world, it->first.first, it->first.second, *dirty);
+        }
+      }
+      
+      // everything drawing on the dirty parts is composited again, in order
+      for (size_t i = 0; i < world.levels.size(); i++) {
+        if (level_is_dirty(s, world, world.levels[i].x, world.levels[i].z, *dirty)) {
+          levels.push_back(i);
+        }
+      }
+      
+      all->clear(*dirty);
+      all_levels = false;
+      
+      if (!s.silent) {
+        cout << "Incremental render of " << levels.size() << " out of " << world.levels.size() << " chunks" << endl;
+      }
+    }
+    else {
+      // whatever was read of a broken canvas
+      memset(canvas_image->get_colors(), 0x0, sizeof(color) * i_w * i_h);
+    }
+    
+    canvas->width = i_w;
+    canvas->height = i_h;
+    canvas->min_x = world.min_x;
+    canvas->min_z = world.min_z;
+    canvas->max_x = world.max_x;
+    canvas->max_z = world.max_z;
+    canvas->chunks.swap(chunks);
+  }
   
-  if (s.binary) {
-    progress_c = cout_progress_b_render;
+  if (all_levels) {
+    levels.resize(world.levels.size());
+    
+    for (size_t i = 0; i < levels.size(); i++) {
+      levels[i] = i;
+    }
   }
   
-  for (i = 0; i < world_size; i++) {
-    if (lvlq == 0) {
-      for (; lvlq < s.threads * 4 && lvlit != world.levels.end(); lvlq++) {
-        level l = *lvlit;
-        
-        fs::path path = world.get_level_path(l);
-        
+  // by the index of the level they were found in, which keeps them in the
+  // same order whatever order the levels are rendered in
+  std::vector<std::pair<size_t, light_marker> > level_markers;
+  
+  // the chunks are composited through a depth plane if there is room for
+  // one, and rendered again to be composited without it if it runs out
+  for (bool try_depth = true; ; try_depth = false) {
+    // chunks drawing over each other can still be composited in any order
+    // through a depth plane, if there is room for one next to the image
+    boost::scoped_ptr<depth_image> depth;
+    
+    size_t depth_x = mem_x + i_w * i_h * depth_image::PIXEL_SIZE;
+    
+    if (try_depth && levels_overlap(s) && depth_x <= s.memory_limit) {
+      depth.reset(new depth_image(*static_cast<memory_image*>(all), s.memory_limit - depth_x));
+    }
+    
+    bool ordered = levels_overlap(s) && !depth;
+    
+    // failing that the threads can still composite them into an image in
+    // memory themselves, a wave at a time
+    wavefront waves;
+    int min_wave = 0;
+    
+    if (ordered && levels_have_waves(s) && mem_x <= s.memory_limit && !levels.empty()) {
+      order_levels(s, world, levels, false);
+      std::stable_sort(levels.begin(), levels.end(), compare_level_waves(s, world.levels));
+      
+      min_wave = level_wave(s, world.levels[levels.front()].x, world.levels[levels.front()].z);
+      
+      for (size_t i = 0; i < levels.size(); i++) {
+        waves.add(level_wave(s, world.levels[levels[i]].x, world.levels[levels[i]].z) - min_wave);
+      }
+      
+      ordered = false;
+    }
+    else {
+      order_levels(s, world, levels, ordered);
+    }
+    
+    // results are composited as soon as they are done unless chunks draw
+    // over each other
+    Renderer renderer(s, s.threads, ordered);
+    
+    // and straight from the threads if they can't even touch the same pixels,
+    // or only touch those of chunks in earlier waves
+    if (!depth && !ordered && mem_x <= s.memory_limit) {
+      renderer.direct = all;
+    }
+    
+    if (levels_overlap(s) && renderer.direct != NULL) {
+      renderer.waves = &waves;
+    }
+    
+    renderer.depth = depth.get();
+    renderer.world = &world;
+    renderer.dirty = dirty.get();
+    
+    // chunks are read ahead by the I/O threads, in order if they have to be
+    // given to the render threads in order
+    Reader reader(s, world, levels, s.threads * 4, ordered || renderer.waves != NULL);
+    
+    renderer.start();
+    unsigned int world_size = levels.size();
+    
+    // jobs given to the render threads, and how many of those are not done
+    unsigned int given = 0;
+    unsigned int lvlq = 0;
+    unsigned int i;
+    
+    level_markers.clear();
+    
+    if (s.binary) {
+      progress_c = cout_progress_b_render;
+    }
+    
+    for (i = 0; i < world_size; i++) {
+      render_job job;
+      
+      // top the render threads up with whatever has been read so far, and
+      // only wait for a chunk to be read when they have nothing left to do
+      while (given < world_size && lvlq < s.threads * 4 && reader.pop(job, lvlq == 0)) {
         if (s.debug) {
-          cout << "using file: " << path << endl;
+          cout << "using file: " << job.path << endl;
         }
         
-        render_job job;
-        job.level.reset(new level_file(s));
-        job.path = path;
-        job.xPos = l.xPos;
-        job.zPos = l.zPos;
+        job.wave = renderer.waves != NULL ? level_wave(s, job.xPos, job.zPos) - min_wave : 0;
         
         renderer.give(job);
-        lvlit++;
+        given++;
+        lvlq++;
+      }
+      
+      --lvlq;
+      
+      render_result p = renderer.get();
+      
+      // nothing more can go in, the chunks are composited again in order
+      if (depth && depth->is_full()) {
+        break;
       }
-    }
-    
-    --lvlq;
-    
-    render_result p = renderer.get();
 
-    boost::shared_ptr<level_file> level(p.level);
-    
-    if (level->grammar_error) {
-      if (s.require_all) {
-        error << "Parser Error: " << p.path.string() << " at (uncompressed) byte " << level->grammar_error_where
-          << " - " << level->grammar_error_why;
+      boost::shared_ptr<level_file> level(p.level);
+      
+      if (level->grammar_error) {
+        if (s.require_all) {
+          error << "Parser Error: " << p.path.string() << " at (uncompressed) byte " << level->grammar_error_where
+            << " - " << level->grammar_error_why;
+          
+          // effectively join all worker threads and prepare for exit
+          waves.stop();
+          renderer.join();
+          return false;
+        }
         
-        // effectively join all worker threads and prepare for exit
-        renderer.join();
-        return false;
+        if (!s.silent) {
+          cout << "Ignoring unparseable file: " << p.path << " - " << level->grammar_error_why << endl;
+          continue;
+        }
       }
       
-      if (!s.silent) {
-        cout << "Ignoring unparseable file: " << p.path << " - " << level->grammar_error_why << endl;
+      if (!level->islevel) {
+        if (s.debug) {
+          cout << "Ignoring file not a level chunk: " << p.path << endl;
+        }
+        
+        continue;
+      }
+      
+      if (progress_c != NULL) progress_c(i, world_size);
+      
+      if (level->markers.size() > 0) {
+        if (s.debug) { cout << "Found " << level->markers.size() << " signs"; };
+        
+        for (std::vector<light_marker>::iterator it = level->markers.begin(); it != level->markers.end(); it++) {
+          level_markers.push_back(std::make_pair(p.index, *it));
+        }
+      }
+      
+      if (!p.operations) {
         continue;
       }
+      
+      try {
+        calc_image_partial(s, p, all, world, dirty.get());
+      } catch(std::ios::failure& e) {
+        error << strerror(errno) << ": " << s.cache_file;
+        waves.stop();
+        renderer.join();
+      }
     }
     
-    if (!level->islevel) {
-      if (s.debug) {
-        cout << "Ignoring file not a level chunk: " << p.path << endl;
+    if (progress_c != NULL) progress_c(world_size, world_size);
+    
+    renderer.join();
+    
+    if (depth && depth->is_full()) {
+      if (!s.silent) {
+        cout << "Out of memory for the depth plane, compositing in order" << endl;
+      }
+      
+      if (dirty) {
+        all->clear(*dirty);
+      }
+      else {
+        memory_image* image = static_cast<memory_image*>(all);
+        memset(image->get_colors(), 0x0, sizeof(color) * i_w * i_h);
       }
       
+      // back in the order they were found in, which order_levels starts from
+      std::sort(levels.begin(), levels.end());
       continue;
     }
     
-    if (progress_c != NULL) progress_c(i, world_size);
-    
-    if (level->markers.size() > 0) {
-      if (s.debug) { cout << "Found " << level->markers.size() << " signs"; };
-      light_markers.insert(light_markers.end(), level->markers.begin(), level->markers.end());
+    if (depth) {
+      depth->resolve();
     }
     
-    try {
-      calc_image_partial(s, p, all, world, i_w, i_h);
-    } catch(std::ios::failure& e) {
-      error << strerror(errno) << ": " << s.cache_file;
-      renderer.join();
-    }
+    break;
   }
   
-  if (progress_c != NULL) progress_c(world_size, world_size);
+  std::stable_sort(level_markers.begin(), level_markers.end(), compare_level_markers);
+  
+  std::vector<light_marker> light_markers;
+  
+  for (size_t i = 0; i < level_markers.size(); i++) {
+    light_markers.push_back(level_markers[i].second);
+  }
   
-  renderer.join();
+  if (canvas) {
+    memory_image* canvas_image = static_cast<memory_image*>(all);
+    
+    if (!canvas->write_pixels(*canvas_image, dirty.get()) || !canvas->write_chunks()) {
+      if (!s.silent) cout << "Failed to save canvas for incremental renders: " << canvas->path << endl;
+    }
+  }
 
   boost::ptr_vector<marker> markers;
 
@@ -524,8 +1458,8 @@ bool do_one_world(settings_t &s, world_info& world, players_db& pdb, warps_db& w
         coordinate_font.set_color(s.coordinate_color);
       }
       
-      for (lvlit = world.levels.begin(); lvlit != world.levels.end(); lvlit++) {
-        level l = *lvlit;
+      for (size_t i = 0; i < world.levels.size(); i++) {
+        level l = world.levels.get(i);
         if (l.zPos - 4 < world.min_z) continue;
         if (l.zPos + 4 > world.max_z) continue;
         if (l.xPos - 4 < world.min_x) continue;
@@ -576,6 +1510,17 @@ bool do_one_world(settings_t &s, world_info& world, players_db& pdb, warps_db& w
     progress_c = cout_progress_b_image;
   }
   
+  // markers drawn on the image may have moved anywhere, otherwise only the
+  // parts of an incremental render that changed have to be saved again
+  bool save_dirty_only = dirty && !(show_markers && !s.write_markers);
+  // the next pass of a watching render can start from the image as it is,
+  // unless there are markers drawn on it
+  bool keep = resident != NULL && canvas && !(show_markers && !s.write_markers);
+  
+  if (resident != NULL) {
+    resident->changed.clear();
+  }
+  
   if (s.use_pixelsplit) {
     std::map<point2, image_base*> parts = image_split(all, s.pixelsplit);
     //boost::ptr_map<point2, image_base> parts;
@@ -587,6 +1532,12 @@ bool do_one_world(settings_t &s, world_info& world, players_db& pdb, warps_db& w
       stringstream ss;
       ss << boost::format(output) % p.x % p.y;
       
+      if (save_dirty_only
+          && !dirty->intersects(p.x * s.pixelsplit, p.y * s.pixelsplit, s.pixelsplit, s.pixelsplit)
+          && fs::exists(ss.str())) {
+        continue;
+      }
+      
       if (!img->save_png(ss.str(), "Map generated by c10t", progress_c)) {
         return false;
       }
@@ -596,16 +1547,88 @@ bool do_one_world(settings_t &s, world_info& world, players_db& pdb, warps_db& w
     //image_base* img = new virtual_image(100, 100, all, 300, 300);
     image_base* img = all;
     
+    if (save_dirty_only && dirty->empty() && output.compare("-") != 0 && fs::exists(output)) {
+      if (!s.silent) cout << "Nothing changed, keeping " << output << endl;
+      release_image(all, canvas, resident, keep);
+      return true;
+    }
+    
     if (!img->save_png(output, "Map generated by c10t", progress_c)) {
       error << strerror(errno);
       return false;
     }
   }
   
-  delete all;
+  release_image(all, canvas, resident, keep);
   return true;
 }
 
+/*
+ * keep rendering a world as its chunks are saved, until killed.
+ */
+bool watch_world(settings_t& s, world_info& world, players_db& pdb, warps_db& wdb, const string& output) {
+  // watching starts before the first pass, so that nothing saved during it
+  // is missed
+  world_watcher watcher(world.world_path);
+  
+  if (!watcher.is_open()) {
+    error << "Cannot watch world: " << watcher.error;
+    return false;
+  }
+  
+  resident_canvas resident;
+  
+  if (!do_one_world(s, world, pdb, wdb, output, &resident)) {
+    return false;
+  }
+  
+  while (true) {
+    if (!s.silent) cout << "Watching " << world.world_path << " for changes..." << endl;
+    
+    std::set<std::string> changed;
+    
+    if (!watcher.wait(s.watch_delay, changed)) {
+      error << "Stopped watching world: " << strerror(errno);
+      return false;
+    }
+    
+    std::vector<fs::path> regions, chunks;
+    
+    for (std::set<std::string>::iterator it = changed.begin(); it != changed.end(); it++) {
+      int x, z;
+      
+      if (parse_region_name(fs::path(*it), x, z)) {
+        regions.push_back(*it);
+      }
+      else {
+        chunks.push_back(*it);
+      }
+    }
+    
+    if (world.regions) {
+      if (regions.empty()) {
+        continue;
+      }
+      
+      // the chunk timestamps of the regions tell what changed
+      world = world_info(s, world.world_path, NULL);
+    }
+    else {
+      if (chunks.empty()) {
+        continue;
+      }
+      
+      world.update_chunk_files(s, chunks, resident.changed);
+    }
+    
+    if (!s.silent) cout << changed.size() << " file(s) changed, rendering again" << endl;
+    
+    if (!do_one_world(s, world, pdb, wdb, output, &resident)) {
+      return false;
+    }
+  }
+}
+
 bool do_world(settings_t& s, fs::path world_path, string output) {
   if (output.empty()) {
     error << "You must specify output file using '-o' to generate map";
@@ -664,6 +1687,10 @@ bool do_world(settings_t& s, fs::path world_path, string output) {
   world_info world(s, world_path, progress_c);
   if (!s.silent) cout << "found " << world.levels.size() << " files!" << endl;
 
+  if (s.watch) {
+    return watch_world(s, world, pdb, wdb, output);
+  }
+  
   if (!s.use_split) {
     return do_one_world(s, world, pdb, wdb, output);
   }
@@ -719,7 +1746,7 @@ int do_help() {
     << "  -D, --debug               - display debug information while executing        " << endl
     << "  -l, --list-colors         - list all available colors and block types        " << endl
     << endl
-    << "  -t, --top <int>           - splice from the top, must be less than 128       " << endl
+    << "  -t, --top <int>           - splice from the top, must be less than 256       " << endl
     << "  -b, --bottom <int>        - splice from the bottom, must be greater than or  " << endl
     << "                              equal to zero.                                   " << endl
     << "  -L, --limits <int-list>   - limit render to certain area. int-list form:     " << endl
@@ -751,6 +1778,23 @@ int do_help() {
     << "  -m, --threads <int>       - Specify the amount of threads to use, for maximum" << endl
     << "                              efficency, this should match the amount of cores " << endl
     << "                              on your machine                                  " << endl
+    << "  --io-threads <int>        - Amount of threads reading chunks ahead of the    " << endl
+    << "                              render threads, defaults to the number of cores. " << endl
+    << "                              More than that helps on slow or network disks, 0 " << endl
+    << "                              reads the chunks on the render threads. Where    " << endl
+    << "                              io_uring is available one thread does all reads  " << endl
+    << "  --io-depth <int>          - Amount of chunk reads kept in flight through     " << endl
+    << "                              io_uring, or hinted to the kernel ahead of the   " << endl
+    << "                              render threads without I/O threads, default 32.  " << endl
+    << "                              0 turns io_uring and the hints off               " << endl
+    << "  --io-order <order>        - Order the I/O threads read chunks in, one of     " << endl
+    << "                              `level' (default, the order they are rendered),  " << endl
+    << "                              `inode' (by file and where in it) or `extent' (by" << endl
+    << "                              physical disk address, through FIEMAP). Cuts down" << endl
+    << "                              on seeking for cold renders off spinning disks   " << endl
+    << "  --io-window <int>         - Amount of chunks ahead of the render threads     " << endl
+    << "                              --io-order reads out of order and holds on to    " << endl
+    << "                              until they are rendered, defaults to 256         " << endl
     << "  -B <set>                  - Specify the base color for a specific block id   " << endl
     << "                              <set> has the format <blockid>=<color>           " << endl
     << "                              <8 digit hex> specifies the RGBA values as       " << endl
@@ -794,6 +1838,9 @@ int do_help() {
     << "                              which helps to distinguish heights               " << endl
     << "  --write-markers <file>    - Write markers to <file> in JSON format instead of" << endl
     << "                              printing them on map                             " << endl
+    << "  --inflate-backend <name>  - Library used to decompress chunks and cache      " << endl
+    << "                              files, either `zlib' or `libdeflate', defaults to" << endl
+    << "                              libdeflate when c10t was built with it           " << endl
     << endl
     << "Font Options:" << endl
     << "  --ttf-path <font>         - Use the following ttf file when drawing text.    " << endl
@@ -816,9 +1863,28 @@ int do_help() {
     << "                              an unique combination of options. The cache files" << endl
     << "                              will be put in                                   " << endl
     << "                              <cache-dir>/<cache-key>/c.<coord>.cmap           " << endl
+    << "                              along with an index of the chunks of the world   " << endl
+    << "                              (world.idx) which saves most of the broad phase  " << endl
     << "  --cache-dir <dir>         - Use the following directory as cache directory   " << endl
     << "                              defaults to 'cache' if not specified             " << endl
     << "  --cache-compress          - Compress the cache files using zlib compression  " << endl
+    << "  --incremental             - Keep the image in the cache directory and only   " << endl
+    << "                              composite and save the parts of it touched by    " << endl
+    << "                              chunks which changed since the last render, needs" << endl
+    << "                              --cache-key and an image that fits in memory     " << endl
+    << "  --watch                   - Keep running after the render and render again   " << endl
+    << "                              whenever chunks of the world are saved, implies  " << endl
+    << "                              --incremental (needs inotify, Linux only)        " << endl
+    << "  --watch-delay <ms>        - Wait until the world has been left alone for <ms>" << endl
+    << "                              milliseconds before rendering it again, defaults " << endl
+    << "                              to 2000                                          " << endl
+    << "  --job-order <order>       - Order chunks are rendered and composited in, one " << endl
+    << "                              of `row' (default, z then x), `morton' (z-order  " << endl
+    << "                              curve) or `tile' (256x256 pixel image tiles).    " << endl
+    << "                              Chunks drawing over each other are kept in row   " << endl
+    << "                              order, so the image stays the same, but the other" << endl
+    << "                              orders keep composites close together which helps" << endl
+    << "                              a cached image (-M)                              " << endl
        /*******************************************************************************/
     << endl;
   cout << endl;
@@ -1127,6 +2193,15 @@ int main(int argc, char *argv[]){
      {"pixelsplit",       required_argument, &flag, 17},
      {"show-warps",       required_argument, &flag, 18},
      {"warp-color",       required_argument, &flag, 19},
+     {"inflate-backend",  required_argument, &flag, 20},
+     {"incremental",      no_argument, &flag, 21},
+     {"watch",            no_argument, &flag, 22},
+     {"watch-delay",      required_argument, &flag, 23},
+     {"job-order",        required_argument, &flag, 24},
+     {"io-threads",       required_argument, &flag, 25},
+     {"io-depth",         required_argument, &flag, 26},
+     {"io-order",         required_argument, &flag, 27},
+     {"io-window",        required_argument, &flag, 28},
      {0, 0, 0, 0}
   };
 
@@ -1280,6 +2355,94 @@ int main(int argc, char *argv[]){
         
         s.has_warp_color = true;
         break;
+      case 20:
+        if (strcmp(optarg, "zlib") == 0) {
+          nbt::set_inflate_backend(nbt::ZLIB);
+        }
+        else if (strcmp(optarg, "libdeflate") == 0) {
+          if (!nbt::set_inflate_backend(nbt::LIBDEFLATE)) {
+            error << "c10t was not built with libdeflate support";
+            goto exit_error;
+          }
+        }
+        else {
+          error << "Not a valid inflate backend: " << optarg;
+          goto exit_error;
+        }
+        
+        break;
+      case 21:
+        s.incremental = true;
+        break;
+      case 22:
+        s.watch = true;
+        s.incremental = true;
+        break;
+      case 23:
+        s.watch_delay = atoi(optarg);
+        
+        if (s.watch_delay < 0) {
+          error << "Delay must be zero or greater";
+          goto exit_error;
+        }
+        
+        break;
+      case 24:
+        if (strcmp(optarg, "row") == 0) {
+          s.job_order = RowOrder;
+        }
+        else if (strcmp(optarg, "morton") == 0) {
+          s.job_order = MortonOrder;
+        }
+        else if (strcmp(optarg, "tile") == 0) {
+          s.job_order = TileOrder;
+        }
+        else {
+          error << "Not a valid job order: " << optarg;
+          goto exit_error;
+        }
+        
+        break;
+      case 25:
+        if (atoi(optarg) < 0) {
+          error << "Number of I/O threads must be 0 or more";
+          goto exit_error;
+        }
+        
+        s.io_threads = atoi(optarg);
+        break;
+      case 26:
+        if (atoi(optarg) < 0) {
+          error << "I/O depth must be 0 or more";
+          goto exit_error;
+        }
+        
+        s.io_depth = atoi(optarg);
+        break;
+      case 27:
+        if (strcmp(optarg, "level") == 0) {
+          s.io_order = LevelIoOrder;
+        }
+        else if (strcmp(optarg, "inode") == 0) {
+          s.io_order = InodeIoOrder;
+        }
+        else if (strcmp(optarg, "extent") == 0) {
+          s.io_order = ExtentIoOrder;
+        }
+        else {
+          error << "Not a valid I/O order: " << optarg;
+          goto exit_error;
+        }
+        
+        break;
+      case 28:
+        if (atoi(optarg) < 1) {
+          error << "I/O window must be 1 or more";
+          goto exit_error;
+        }
+        
+        s.io_window = atoi(optarg);
+        break;
       }
       
       continue;
@@ -1368,8 +2531,8 @@ int main(int argc, char *argv[]){
     case 't':
       s.top = atoi(optarg);
       
-      if (!(s.top > s.bottom && s.top < mc::MapY)) {
-        error << "Top limit must be between `<bottom limit> - " << mc::MapY << "', not " << s.top;
+      if (!(s.top > s.bottom && s.top < mc::anvil_geometry::MapY)) {
+        error << "Top limit must be between `<bottom limit> - " << mc::anvil_geometry::MapY << "', not " << s.top;
         goto exit_error;
       }
       
@@ -1422,6 +2585,16 @@ int main(int argc, char *argv[]){
     }
   }
 
+  if (s.watch && (s.use_split || output_path.compare("-") == 0)) {
+    error << "Watching a world can't be combined with `--split' or output to stdout";
+    goto exit_error;
+  }
+  
+  if (s.incremental && s.cache_key.empty()) {
+    error << "Incremental renders need a cache, see `--cache-key'";
+    goto exit_error;
+  }
+  
   if (!s.cache_key.empty()) {
     if (!fs::is_directory(s.cache_dir)) {
       error << "Directory required for caching: " << s.cache_dir.string();
@@ -2,7 +2,445 @@
 // (C) Copyright 2010 John-John Tedro et al.
 #include "nbt.h"
 
+#include "config.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include <vector>
+
+#if !defined(C10T_DISABLE_THREADS)
+#  include <boost/thread/tss.hpp>
+#  include <boost/thread/mutex.hpp>
+#endif
+
+#if defined(C10T_HAVE_LIBDEFLATE)
+#  include <libdeflate.h>
+#endif
+
 bool nbt::is_big_endian() {
   int32_t i = 1;
   return ((int8_t*)(&i))[0] == 0;
 }
+
+bool nbt::buffer::reserve(size_t capacity) {
+  if (capacity <= this->capacity) {
+    return true;
+  }
+
+  uint8_t *data = reinterpret_cast<uint8_t*>(realloc(this->data, capacity));
+
+  if (data == NULL) {
+    return false;
+  }
+
+  this->data = data;
+  this->capacity = capacity;
+  return true;
+}
+
+/*
+ * Per-thread scratch state for reading and inflating files.
+ */
+struct thread_state {
+  // the inflate buffer handed out by thread_buffer
+  nbt::buffer out;
+  // the compressed contents of the file being inflated
+  nbt::buffer in;
+#if defined(C10T_HAVE_LIBDEFLATE)
+  libdeflate_decompressor *decompressor;
+  // only threads writing files need one, so it's allocated on first use
+  libdeflate_compressor *compressor;
+#endif
+  
+  thread_state() {
+#if defined(C10T_HAVE_LIBDEFLATE)
+    decompressor = libdeflate_alloc_decompressor();
+    compressor = NULL;
+#endif
+  }
+  
+  ~thread_state() {
+#if defined(C10T_HAVE_LIBDEFLATE)
+    if (decompressor != NULL) {
+      libdeflate_free_decompressor(decompressor);
+    }
+    
+    if (compressor != NULL) {
+      libdeflate_free_compressor(compressor);
+    }
+#endif
+  }
+};
+
+#if !defined(C10T_DISABLE_THREADS)
+static boost::thread_specific_ptr<thread_state> thread_states;
+
+static thread_state& get_thread_state() {
+  thread_state *state = thread_states.get();
+
+  if (state == NULL) {
+    state = new thread_state();
+    thread_states.reset(state);
+  }
+
+  return *state;
+}
+#else
+static thread_state& get_thread_state() {
+  static thread_state state;
+  return state;
+}
+#endif
+
+nbt::buffer& nbt::thread_buffer() {
+  return get_thread_state().out;
+}
+
+#if defined(C10T_HAVE_LIBDEFLATE)
+static nbt::inflate_backend current_backend = nbt::LIBDEFLATE;
+#else
+static nbt::inflate_backend current_backend = nbt::ZLIB;
+#endif
+
+bool nbt::set_inflate_backend(nbt::inflate_backend backend) {
+#if !defined(C10T_HAVE_LIBDEFLATE)
+  if (backend == nbt::LIBDEFLATE) {
+    return false;
+  }
+#endif
+
+  current_backend = backend;
+  return true;
+}
+
+nbt::inflate_backend nbt::get_inflate_backend() {
+  return current_backend;
+}
+
+static std::vector<nbt::buffer*> pooled_buffers;
+
+#if !defined(C10T_DISABLE_THREADS)
+static boost::mutex pooled_buffers_mutex;
+#endif
+
+nbt::buffer* nbt::acquire_buffer() {
+#if !defined(C10T_DISABLE_THREADS)
+  boost::mutex::scoped_lock lock(pooled_buffers_mutex);
+#endif
+
+  if (pooled_buffers.empty()) {
+    return new nbt::buffer();
+  }
+
+  nbt::buffer *buf = pooled_buffers.back();
+  pooled_buffers.pop_back();
+  return buf;
+}
+
+void nbt::release_buffer(nbt::buffer* buf) {
+#if !defined(C10T_DISABLE_THREADS)
+  boost::mutex::scoped_lock lock(pooled_buffers_mutex);
+#endif
+
+  buf->size = 0;
+  pooled_buffers.push_back(buf);
+}
+
+/*
+ * read the whole file at path into in, in one go whenever the size is known.
+ */
+const char* nbt::read_file(const char *path, nbt::buffer& in) {
+  in.size = 0;
+
+  FILE *fp = fopen(path, "rb");
+
+  if (fp == NULL) {
+    return strerror(errno);
+  }
+
+  if (fseek(fp, 0, SEEK_END) == 0) {
+    long size = ftell(fp);
+
+    // one extra byte so that the read below hits the end of the file
+    if (size > 0 && !in.reserve(size + 1)) {
+      fclose(fp);
+      return "Failed to allocate read buffer";
+    }
+
+    rewind(fp);
+  }
+
+  const char *why = NULL;
+
+  while (true) {
+    if (in.size == in.capacity
+        && !in.reserve(std::max(in.capacity * 2, size_t(NBT_READ_SIZE)))) {
+      why = "Failed to allocate read buffer";
+      break;
+    }
+
+    size_t read = fread(in.data + in.size, 1, in.capacity - in.size, fp);
+
+    if (read == 0) {
+      if (ferror(fp)) {
+        why = strerror(errno);
+      }
+
+      break;
+    }
+
+    in.size += read;
+  }
+
+  fclose(fp);
+  return why;
+}
+
+static const char* inflate_zlib(const uint8_t *data, size_t size, nbt::buffer& out) {
+  z_stream strm;
+  memset(&strm, 0x0, sizeof(z_stream));
+
+  // 15 window bits, +32 to detect gzip or zlib headers
+  if (inflateInit2(&strm, 15 + 32) != Z_OK) {
+    return "Failed to initialize zlib";
+  }
+
+  strm.next_in = const_cast<uint8_t*>(data);
+  strm.avail_in = size;
+
+  const char *why = NULL;
+
+  while (true) {
+    strm.next_out = out.data + out.size;
+    strm.avail_out = out.capacity - out.size;
+
+    int ret = inflate(&strm, Z_FINISH);
+
+    out.size = out.capacity - strm.avail_out;
+
+    if (ret == Z_STREAM_END) {
+      break;
+    }
+
+    // the size hint was off, make some more room and keep going
+    if ((ret == Z_OK || ret == Z_BUF_ERROR) && strm.avail_out == 0) {
+      if (!out.reserve(out.capacity * 2)) {
+        why = "Failed to allocate inflate buffer";
+        break;
+      }
+
+      continue;
+    }
+
+    if (ret == Z_BUF_ERROR) {
+      why = "Unexpected end of compressed stream";
+    }
+    else {
+      why = strm.msg != NULL ? strm.msg : "Failed to inflate stream";
+    }
+
+    break;
+  }
+
+  inflateEnd(&strm);
+  return why;
+}
+
+#if defined(C10T_HAVE_LIBDEFLATE)
+static const char* inflate_libdeflate(libdeflate_decompressor *decompressor,
+    bool gzip, const uint8_t *data, size_t size, nbt::buffer& out)
+{
+  while (true) {
+    size_t actual = 0;
+    libdeflate_result result;
+
+    if (gzip) {
+      result = libdeflate_gzip_decompress(decompressor, data, size, out.data, out.capacity, &actual);
+    }
+    else {
+      result = libdeflate_zlib_decompress(decompressor, data, size, out.data, out.capacity, &actual);
+    }
+
+    switch (result) {
+    case LIBDEFLATE_SUCCESS:
+      out.size = actual;
+      return NULL;
+    case LIBDEFLATE_INSUFFICIENT_SPACE:
+      if (!out.reserve(out.capacity * 2)) {
+        return "Failed to allocate inflate buffer";
+      }
+
+      break;
+    default:
+      return "Failed to inflate stream";
+    }
+  }
+}
+#endif
+
+const char* nbt::inflate_buffer(const uint8_t *data, size_t size, nbt::buffer& out) {
+  out.size = 0;
+
+  if (size == 0) {
+    return "File is empty";
+  }
+
+  // not compressed at all, gzread used to pass these through as well
+  if (data[0] == TAG_Compound) {
+    if (!out.reserve(size)) {
+      return "Failed to allocate inflate buffer";
+    }
+
+    memcpy(out.data, data, size);
+    out.size = size;
+    return NULL;
+  }
+
+  bool gzip = size >= 18 && data[0] == 0x1f && data[1] == 0x8b;
+  size_t expected = NBT_BUFFER_SIZE;
+
+  // the gzip trailer (ISIZE) holds the uncompressed size modulo 2^32,
+  // which lets the output be allocated exactly once
+  if (gzip) {
+    const uint8_t *isize = data + size - 4;
+    expected = isize[0] | (isize[1] << 8) | (isize[2] << 16) | (size_t(isize[3]) << 24);
+    // deflate can't do better than ~1032:1, anything above is a bogus trailer
+    expected = std::min(expected, size * 1032);
+  }
+
+  if (!out.reserve(std::max(expected, size_t(1)))) {
+    return "Failed to allocate inflate buffer";
+  }
+
+#if defined(C10T_HAVE_LIBDEFLATE)
+  thread_state& state = get_thread_state();
+  bool zlib = size >= 2 && (data[0] & 0x0f) == Z_DEFLATED && ((data[0] << 8) | data[1]) % 31 == 0;
+
+  if (current_backend == nbt::LIBDEFLATE && state.decompressor != NULL && (gzip || zlib)) {
+    return inflate_libdeflate(state.decompressor, gzip, data, size, out);
+  }
+#endif
+
+  return inflate_zlib(data, size, out);
+}
+
+const char* nbt::inflate_file(const char *path, nbt::buffer& out) {
+  nbt::buffer& in = get_thread_state().in;
+
+  const char *why = nbt::read_file(path, in);
+
+  if (why != NULL) {
+    return why;
+  }
+
+  return nbt::inflate_buffer(in.data, in.size, out);
+}
+
+const char* nbt::deflate_file(const char *path, const uint8_t *data, size_t size) {
+#if defined(C10T_HAVE_LIBDEFLATE)
+  if (current_backend == nbt::LIBDEFLATE) {
+    thread_state& state = get_thread_state();
+
+    if (state.compressor == NULL) {
+      state.compressor = libdeflate_alloc_compressor(6);
+
+      if (state.compressor == NULL) {
+        return "Failed to allocate compressor";
+      }
+    }
+
+    nbt::buffer& out = state.in;
+    size_t bound = libdeflate_gzip_compress_bound(state.compressor, size);
+
+    if (!out.reserve(bound)) {
+      return "Failed to allocate deflate buffer";
+    }
+
+    out.size = libdeflate_gzip_compress(state.compressor, data, size, out.data, out.capacity);
+
+    if (out.size == 0) {
+      return "Failed to deflate stream";
+    }
+
+    FILE *fp = fopen(path, "wb");
+
+    if (fp == NULL) {
+      return strerror(errno);
+    }
+
+    bool ok = fwrite(out.data, 1, out.size, fp) == out.size;
+
+    if (fclose(fp) != 0 || !ok) {
+      return strerror(errno);
+    }
+
+    return NULL;
+  }
+#endif
+
+  gzFile fp = gzopen(path, "wb");
+
+  if (fp == NULL) {
+    return strerror(errno);
+  }
+
+  size_t written = 0;
+
+  while (written < size) {
+    int w = gzwrite(fp, data + written, size - written);
+
+    if (w <= 0) {
+      gzclose(fp);
+      return "Failed to deflate stream";
+    }
+
+    written += w;
+  }
+
+  if (gzclose(fp) != Z_OK) {
+    return "Failed to deflate stream";
+  }
+
+  return NULL;
+}
+
+bool nbt::path_query::add(const nbt::String& path) {
+  if (paths.size() >= MAX_PATHS) {
+    return false;
+  }
+
+  std::vector<component> components;
+  size_t first = 0;
+
+  while (true) {
+    size_t next = path.find('/', first);
+    component c;
+    c.name = path.substr(first, next == nbt::String::npos ? nbt::String::npos : next - first);
+
+    if (c.name.empty()) {
+      return false;
+    }
+
+    c.hash = nbt::detail::hash_name(c.name.data(), c.name.size());
+    c.wildcard = c.name.compare("*") == 0;
+    components.push_back(c);
+
+    if (next == nbt::String::npos) {
+      break;
+    }
+
+    first = next + 1;
+  }
+
+  size_t c = 0;
+
+  while (c < components.size() && !components[c].wildcard) {
+    c++;
+  }
+
+  paths.push_back(components);
+  concrete.push_back(c);
+  return true;
+}
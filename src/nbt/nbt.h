@@ -15,28 +15,23 @@
 #include <string>
 #include <stack>
 #include <list>
+#include <vector>
 
 #include <boost/ptr_container/ptr_vector.hpp>
 
 namespace nbt {
   class bad_grammar : std::exception {};
   #define NBT_STACK_SIZE 100
-
-  #define nbt_assert_error(exc_env, zfile, cond, why)                \
-  do {                                                  \
-  if (!(cond)) {                                           \
-    size_t where = file == NULL ? 0 : gztell(file);     \
-    error_handler(context, where, why);                 \
-    longjmp(exc_env, 1);                                \
-  }                                                     \
-  } while(0)
   
-  #define assert_error_c(exc_env, zfile, cond, why, cleanup)     \
+  // initial capacity of an inflate buffer, big enough for most chunk files
+  #define NBT_BUFFER_SIZE 0x20000
+  // size of the compressed read-ahead used while inflating
+  #define NBT_READ_SIZE 0x8000
+  
+  #define nbt_assert_error(exc_env, cond, why)          \
   do {                                                  \
-  if (!(cond)) {                                           \
-    size_t where = file == NULL ? 0 : gztell(file);     \
-    error_handler(context, where, why);                 \
-    cleanup;                                            \
+  if (!(cond)) {                                        \
+    handler.error_handler(pos - begin, why);            \
     longjmp(exc_env, 1);                                \
   }                                                     \
   } while(0)
@@ -52,18 +47,19 @@ namespace nbt {
   struct ByteArray {
     Int length;
     Byte *values;
+    // false when values is a view into the buffer the array was parsed from
+    bool owned;
+    
+    ByteArray() : length(0), values(NULL), owned(true) {
+    }
+    
     ~ByteArray() {
-      delete [] values;
+      if (owned) {
+        delete [] values;
+      }
     }
   };
 
-  struct stack_entry {
-    Byte type;
-    String name;
-    Int list_count, list_read;
-    Byte list_type;
-  };
-  
   const Byte TAG_End = 0x0;
   const Byte TAG_Byte = 0x1;
   const Byte TAG_Short = 0x2;
@@ -75,6 +71,7 @@ namespace nbt {
   const Byte TAG_String = 0x8;
   const Byte TAG_List = 0x9;
   const Byte TAG_Compound = 0xa;
+  const Byte TAG_Int_Array = 0xb;
   
   const std::string TAG_End_str("TAG_End");
   const std::string TAG_Byte_str("TAG_Byte");
@@ -87,6 +84,7 @@ namespace nbt {
   const std::string TAG_String_str("TAG_String");
   const std::string TAG_List_str("TAG_List");
   const std::string TAG_Compound_str("TAG_Compound");
+  const std::string TAG_Int_Array_str("TAG_Int_Array");
   
   const std::string tag_string_map[] = {
     TAG_End_str,
@@ -99,295 +97,718 @@ namespace nbt {
     TAG_Byte_Array_str,
     TAG_String_str,
     TAG_List_str,
-    TAG_Compound_str
+    TAG_Compound_str,
+    TAG_Int_Array_str
   };
   
   bool is_big_endian();
   
-  template <class C>
-  void default_begin_compound(C* context, nbt::String name) {
-    //std::cout << "TAG_Compound('" << name << "') BEGIN" << std::endl;
-  }
-
-  template <class C>
-  void default_end_compound(C* context, String name) {
-    //std::cout << "TAG_Compound END" << std::endl;
-  }
-
-  template <class C>
-  void default_begin_list(C* context, nbt::String name, nbt::Byte type, nbt::Int length) {
-    //std::cout << "TAG_List('" << name << "'): " << length << " items" << std::endl;
-  }
-
-  template <class C>
-  void default_end_list(C* context, nbt::String name) {
-    //std::cout << "TAG_List END" << std::endl;
-  }
-
-  template <class C>
-  void default_error_handler(C* context, size_t where, const char *why) {
-    std::cerr << "Unhandled nbt parser error at byte " << where << ": " << why << std::endl;
-    exit(1);
+  /**
+   * Growable byte buffer holding a whole inflated nbt file.
+   *
+   * Buffers are meant to be reused between files, the allocation is only
+   * grown and never shrunk.
+   */
+  class buffer {
+    private:
+      buffer(const buffer&);
+      buffer& operator=(const buffer&);
+    public:
+      uint8_t *data;
+      size_t size;
+      size_t capacity;
+      
+      buffer() : data(NULL), size(0), capacity(0) {
+      }
+      
+      ~buffer() {
+        free(data);
+      }
+      
+      bool reserve(size_t capacity);
+  };
+  
+  /**
+   * The inflate buffer reused by all parsers running on the calling thread.
+   */
+  buffer& thread_buffer();
+  
+  /**
+   * Take a buffer out of the process wide buffer pool, for files which keep
+   * views into their inflated data after parsing has finished.
+   * Buffers must be given back using release_buffer.
+   */
+  buffer* acquire_buffer();
+  void release_buffer(buffer* buf);
+  
+  enum inflate_backend {
+    ZLIB,
+    // single-shot decompression, only available when built with libdeflate
+    LIBDEFLATE
+  };
+  
+  /**
+   * Select the library used to (de)compress whole files, returns false if
+   * the backend is not available in this build.
+   */
+  bool set_inflate_backend(inflate_backend backend);
+  inflate_backend get_inflate_backend();
+  
+  /**
+   * Read the whole file at `path' into `out' as it is.
+   *
+   * Returns NULL on success, or a description of the error.
+   */
+  const char* read_file(const char *path, buffer& out);
+  
+  /**
+   * Inflate the whole gzip or zlib compressed file at `path' into `out'.
+   * Uncompressed nbt files are copied as-is.
+   *
+   * Returns NULL on success, or a description of the error.
+   */
+  const char* inflate_file(const char *path, buffer& out);
+  
+  /**
+   * As inflate_file, for compressed data which is already in memory.
+   */
+  const char* inflate_buffer(const uint8_t *data, size_t size, buffer& out);
+  
+  /**
+   * Write `data' gzip compressed to the file at `path'.
+   *
+   * Returns NULL on success, or a description of the error.
+   */
+  const char* deflate_file(const char *path, const uint8_t *data, size_t size);
+  
+  namespace detail {
+    inline uint16_t bswap16(uint16_t v) {
+      return (v << 8) | (v >> 8);
+    }
+    
+#if defined(__GNUC__)
+    inline uint32_t bswap32(uint32_t v) { return __builtin_bswap32(v); }
+    inline uint64_t bswap64(uint64_t v) { return __builtin_bswap64(v); }
+#elif defined(_MSC_VER)
+    inline uint32_t bswap32(uint32_t v) { return _byteswap_ulong(v); }
+    inline uint64_t bswap64(uint64_t v) { return _byteswap_uint64(v); }
+#else
+    inline uint32_t bswap32(uint32_t v) {
+      return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+    }
+    
+    inline uint64_t bswap64(uint64_t v) {
+      return (uint64_t(bswap32(uint32_t(v))) << 32) | bswap32(uint32_t(v >> 32));
+    }
+#endif
+    
+    /* unaligned big endian loads, nbt is always stored big endian */
+    inline uint16_t load16(const uint8_t *p) {
+      uint16_t v;
+      memcpy(&v, p, sizeof(v));
+#ifdef BOOST_BIG_ENDIAN
+      return v;
+#else
+      return bswap16(v);
+#endif
+    }
+    
+    inline uint32_t load32(const uint8_t *p) {
+      uint32_t v;
+      memcpy(&v, p, sizeof(v));
+#ifdef BOOST_BIG_ENDIAN
+      return v;
+#else
+      return bswap32(v);
+#endif
+    }
+    
+    inline uint64_t load64(const uint8_t *p) {
+      uint64_t v;
+      memcpy(&v, p, sizeof(v));
+#ifdef BOOST_BIG_ENDIAN
+      return v;
+#else
+      return bswap64(v);
+#endif
+    }
+    
+    /* FNV-1a, tag names are short enough for this to be cheaper than a compare */
+    inline uint32_t hash_name(const char *data, size_t length) {
+      uint32_t h = 2166136261u;
+      
+      for (size_t i = 0; i < length; i++) {
+        h = (h ^ uint8_t(data[i])) * 16777619u;
+      }
+      
+      return h;
+    }
   }
   
-  template <class C>
-  class Parser {
+  /**
+   * A tag name to compare parsed names against, hashed once up front.
+   * Handlers keep these as statics, e.g.
+   *
+   *   static const nbt::NameKey Blocks_key("Blocks");
+   *
+   * The key refers to `data', which must outlive it.
+   */
+  struct NameKey {
+    const char *data;
+    size_t length;
+    uint32_t hash;
+    
+    NameKey(const char *data) :
+      data(data), length(strlen(data)), hash(detail::hash_name(data, length))
+    {
+    }
+    
+    NameKey(const char *data, size_t length) :
+      data(data), length(length), hash(detail::hash_name(data, length))
+    {
+    }
+  };
+  
+  /**
+   * The name of a parsed tag, a view into the buffer being parsed.
+   *
+   * Names are only valid until parsing of the buffer is done, use str() to
+   * keep one around.
+   */
+  struct Name {
+    const char *data;
+    size_t length;
+    uint32_t hash;
+    
+    Name() : data(""), length(0), hash(detail::hash_name("", 0)) {
+    }
+    
+    Name(const char *data, size_t length) :
+      data(data), length(length), hash(detail::hash_name(data, length))
+    {
+    }
+    
+    inline bool operator==(const NameKey& key) const {
+      return hash == key.hash && length == key.length && memcmp(data, key.data, length) == 0;
+    }
+    
+    inline bool operator!=(const NameKey& key) const {
+      return !(*this == key);
+    }
+    
+    inline String str() const {
+      return String(data, length);
+    }
+  };
+  
+  /**
+   * A list of fixed size values (TAG_Byte up to TAG_Double), as a view into
+   * the buffer being parsed. Values are decoded on access, and the view is
+   * only valid during the event it is passed to.
+   */
+  struct ListArray {
+    Byte type;
+    Int length;
+    const uint8_t *data;
+    
+    inline Byte byte_at(Int i) const {
+      return static_cast<Byte>(data[i]);
+    }
+    
+    inline Short short_at(Int i) const {
+      return static_cast<Short>(detail::load16(data + i * sizeof(Short)));
+    }
+    
+    inline Int int_at(Int i) const {
+      return static_cast<Int>(detail::load32(data + i * sizeof(Int)));
+    }
+    
+    inline Long long_at(Int i) const {
+      return static_cast<Long>(detail::load64(data + i * sizeof(Long)));
+    }
+    
+    inline Float float_at(Int i) const {
+      uint32_t v = detail::load32(data + i * sizeof(Float));
+      Float f;
+      memcpy(&f, &v, sizeof(f));
+      return f;
+    }
+    
+    inline Double double_at(Int i) const {
+      uint64_t v = detail::load64(data + i * sizeof(Double));
+      Double d;
+      memcpy(&d, &v, sizeof(d));
+      return d;
+    }
+  };
+  
+  struct stack_entry {
+    Byte type;
+    Name name;
+    Int list_count, list_read;
+    Byte list_type;
+    // path_query state, see basic_parser::parse_buffer
+    bool all;
+    uint32_t mask, done;
+  };
+  
+  
+  /**
+   * A compiled set of wanted paths into an nbt structure, relative to the
+   * root compound, e.g. `Level/Blocks'.
+   *
+   * A `*' component matches any single name, including the unnamed items of
+   * lists. Everything below a matching path is parsed, ancestors of wanted
+   * paths are only walked and anything else is skipped over.
+   */
+  class path_query {
+    private:
+      struct component {
+        String name;
+        uint32_t hash;
+        bool wildcard;
+      };
+      
+      std::vector< std::vector<component> > paths;
+      // the number of leading components of each path without wildcards
+      std::vector<size_t> concrete;
+    public:
+      static const size_t MAX_PATHS = 32;
+      
+      bool add(const String& path);
+      
+      size_t size() const {
+        return paths.size();
+      }
+      
+      uint32_t all_mask() const {
+        return paths.size() == MAX_PATHS ? ~uint32_t(0) : (uint32_t(1) << paths.size()) - 1;
+      }
+      
+      /*
+       * the paths in mask that continue with name at component index
+       */
+      inline uint32_t step(uint32_t mask, size_t index, const Name& name) const {
+        uint32_t result = 0;
+        
+        for (size_t i = 0; i < paths.size(); i++) {
+          if (!(mask & (uint32_t(1) << i))) continue;
+          if (!(index < paths[i].size())) continue;
+          
+          const component& c = paths[i][index];
+          
+          if (c.wildcard || (c.hash == name.hash && c.name.size() == name.length
+                && memcmp(c.name.data(), name.data, name.length) == 0)) {
+            result |= uint32_t(1) << i;
+          }
+        }
+        
+        return result;
+      }
+      
+      /*
+       * the paths in mask that are exactly length components long
+       */
+      inline uint32_t complete(uint32_t mask, size_t length) const {
+        uint32_t result = 0;
+        
+        for (size_t i = 0; i < paths.size(); i++) {
+          if ((mask & (uint32_t(1) << i)) && paths[i].size() == length) {
+            result |= uint32_t(1) << i;
+          }
+        }
+        
+        return result;
+      }
+      
+      /*
+       * the paths in mask which have been seen in full once a node at depth
+       * length has been parsed, since nothing after it can match them.
+       */
+      inline uint32_t seen(uint32_t mask, size_t length) const {
+        uint32_t result = 0;
+        
+        for (size_t i = 0; i < paths.size(); i++) {
+          if ((mask & (uint32_t(1) << i)) && concrete[i] == length) {
+            result |= uint32_t(1) << i;
+          }
+        }
+        
+        return result;
+      }
+  };
+  
+  /**
+   * Base for the handlers of a basic_parser, implementing every event as a
+   * no-op.
+   *
+   * Handlers derive from this, hide the events they want and set the
+   * matching has_* flag. Values for which the flag is false are skipped
+   * over without being decoded.
+   *
+   * With has_list_array set (and wants(TAG_List)), lists of fixed size values
+   * are delivered whole through register_list_array instead of as
+   * begin_list, one event per item and end_list.
+   */
+  struct null_handler {
+    static const bool has_long = false;
+    static const bool has_short = false;
+    static const bool has_string = false;
+    static const bool has_float = false;
+    static const bool has_double = false;
+    static const bool has_int = false;
+    static const bool has_byte = false;
+    static const bool has_byte_array = false;
+    static const bool has_list_array = false;
+    
+    // runtime veto for a value type which has its has_* flag set
+    inline bool wants(Byte type) { return true; }
+    
+    inline void begin_compound(const Name& name) {}
+    inline void end_compound(const Name& name) {}
+    inline void begin_list(const Name& name, Byte type, Int length) {}
+    inline void end_list(const Name& name) {}
+    
+    inline void register_long(const Name& name, Long l) {}
+    inline void register_short(const Name& name, Short s) {}
+    inline void register_string(const Name& name, const String& s) {}
+    inline void register_float(const Name& name, Float f) {}
+    inline void register_double(const Name& name, Double d) {}
+    inline void register_int(const Name& name, Int i) {}
+    inline void register_byte(const Name& name, Byte b) {}
+    inline void register_byte_array(const Name& name, ByteArray* array) { delete array; }
+    inline void register_list_array(const Name& name, const ListArray& array) {}
+    
+    inline void error_handler(size_t where, const char *why) {
+      std::cerr << "Unhandled nbt parser error at byte " << where << ": " << why << std::endl;
+      exit(1);
+    }
+  };
+  
+  /**
+   * The nbt tokenizer, calling the events of H directly so that they can be
+   * inlined into the parsing loop.
+   */
+  template <class H>
+  class basic_parser {
     private:
       jmp_buf exc_env;
       bool running;
-      C *context;
+      H& handler;
+      
+      // reused between files, names on it are views into the parsed buffer
+      stack_entry stack[NBT_STACK_SIZE];
+      
+      // the inflated file being parsed
+      const uint8_t *begin;
+      const uint8_t *pos;
+      const uint8_t *end;
+      
+      inline void skip(size_t length, const char *why) {
+        nbt_assert_error(exc_env, length <= size_t(end - pos), why);
+        pos += length;
+      }
       
-      inline Byte read_byte(gzFile file) {
-        Byte b;
-        nbt_assert_error(exc_env, file, gzread(file, &b, sizeof(Byte)) == sizeof(Byte), "Buffer too short to read Byte");
-        return b;
+      inline Byte read_byte() {
+        nbt_assert_error(exc_env, pos < end, "Buffer too short to read Byte");
+        return static_cast<Byte>(*pos++);
       }
       
-      inline Short read_short(gzFile file) {
-        uint8_t b[2];
-        nbt_assert_error(exc_env, file, gzread(file, b, sizeof(b)) == sizeof(b), "Buffer to short to read Short");
-        Short s = (b[0] << 8) + b[1];
+      inline Short read_short() {
+        nbt_assert_error(exc_env, sizeof(Short) <= size_t(end - pos), "Buffer to short to read Short");
+        Short s = static_cast<Short>(detail::load16(pos));
+        pos += sizeof(Short);
         return s;
       }
 
-      inline Int read_int(gzFile file) {
-        Int i;
-        
-#ifdef BOOST_BIG_ENDIAN
-        nbt_assert_error(exc_env, file, gzread(file, &i, sizeof(b)) == sizeof(b), "Buffer to short to read Int");
-#else
-        Byte b[sizeof(i)];
-        nbt_assert_error(exc_env, file, gzread(file, b, sizeof(b)) == sizeof(b), "Buffer to short to read Int");
-        Int *ip = &i;
-        *((Byte*)ip) = b[3];
-        *((Byte*)ip + 1) = b[2];
-        *((Byte*)ip + 2) = b[1];
-        *((Byte*)ip + 3) = b[0];
-#endif
-        
+      inline Int read_int() {
+        nbt_assert_error(exc_env, sizeof(Int) <= size_t(end - pos), "Buffer to short to read Int");
+        Int i = static_cast<Int>(detail::load32(pos));
+        pos += sizeof(Int);
         return i;
       }
       
-      inline String read_string(gzFile file) {
-        Short s = read_short(file);
-        nbt_assert_error(exc_env, file, s >= 0, "String specified with invalid length < 0");
-        uint8_t *str = new uint8_t[s + 1];
-        assert_error_c(exc_env, file, gzread(file, str, s) == s, "Buffer to short to read String", delete str);
-        String so((const char*)str, s);
-        delete [] str;
+      inline String read_string() {
+        Short s = read_short();
+        nbt_assert_error(exc_env, s >= 0, "String specified with invalid length < 0");
+        nbt_assert_error(exc_env, size_t(s) <= size_t(end - pos), "Buffer to short to read String");
+        String so(reinterpret_cast<const char*>(pos), s);
+        pos += s;
         return so;
       }
       
-      inline void flush_string(gzFile file) {
-        Short s = read_short(file);
-        nbt_assert_error(exc_env, file, gzseek(file, s, SEEK_CUR) != -1, "Buffer to short to flush String");
+      inline Name read_name() {
+        Short s = read_short();
+        nbt_assert_error(exc_env, s >= 0, "String specified with invalid length < 0");
+        nbt_assert_error(exc_env, size_t(s) <= size_t(end - pos), "Buffer to short to read String");
+        Name name(reinterpret_cast<const char*>(pos), s);
+        pos += s;
+        return name;
       }
       
-      inline Float read_float(gzFile file)
-      {
+      inline void flush_string() {
+        Short s = read_short();
+        nbt_assert_error(exc_env, s >= 0, "String specified with invalid length < 0");
+        skip(s, "Buffer to short to flush String");
+      }
+      
+      inline Float read_float() {
+        nbt_assert_error(exc_env, sizeof(Float) <= size_t(end - pos), "Buffer to short to read Float");
+        uint32_t v = detail::load32(pos);
+        pos += sizeof(Float);
         Float f;
-        
-#ifdef BOOST_BIG_ENDIAN
-        nbt_assert_error(exc_env, file, gzread(file, &f, sizeof(f)) == sizeof(f), "Buffer to short to read Float");
-#else
-        Byte b[sizeof(f)];
-        nbt_assert_error(exc_env, file, gzread(file, b, sizeof(f)) == sizeof(f), "Buffer to short to read Float");
-        Float *fp = &f;
-        *((Byte*)fp) = b[3];
-        *((Byte*)fp + 1) = b[2];
-        *((Byte*)fp + 2) = b[1];
-        *((Byte*)fp + 3) = b[0];
-#endif
-        
+        memcpy(&f, &v, sizeof(f));
         return f;
       }
       
-      inline Long read_long(gzFile file) {
-        Long l;
-        
-#ifdef BOOST_BIG_ENDIAN
-        nbt_assert_error(exc_env, file, gzread(file, &l, sizeof(b)) == sizeof(b), "Buffer to short to read Long");
-#else
-        Byte b[sizeof(l)];
-        nbt_assert_error(exc_env, file, gzread(file, b, sizeof(b)) == sizeof(b), "Buffer to short to read Long");
-        Long *lp = &l;
-        *((Byte*)lp) = b[7];
-        *((Byte*)lp + 1) = b[6];
-        *((Byte*)lp + 2) = b[5];
-        *((Byte*)lp + 3) = b[4];
-        *((Byte*)lp + 4) = b[3];
-        *((Byte*)lp + 5) = b[2];
-        *((Byte*)lp + 6) = b[1];
-        *((Byte*)lp + 7) = b[0];
-#endif
-        
+      inline Long read_long() {
+        nbt_assert_error(exc_env, sizeof(Long) <= size_t(end - pos), "Buffer to short to read Long");
+        Long l = static_cast<Long>(detail::load64(pos));
+        pos += sizeof(Long);
         return l;
       }
       
-      inline Double read_double(gzFile file) {
+      inline Double read_double() {
+        nbt_assert_error(exc_env, sizeof(Double) <= size_t(end - pos), "Buffer to short to read Double");
+        uint64_t v = detail::load64(pos);
+        pos += sizeof(Double);
         Double d;
-        
-#ifdef BOOST_BIG_ENDIAN
-        nbt_assert_error(exc_env, file, gzread(file, &d, sizeof(d)) == sizeof(d), "Buffer to short to read Double");
-#else
-        Byte b[sizeof(d)];
-        nbt_assert_error(exc_env, file, gzread(file, b, sizeof(d)) == sizeof(d), "Buffer to short to read Double");
-        Double *dp = &d;
-        *((Byte*)dp) = b[7];
-        *((Byte*)dp + 1) = b[6];
-        *((Byte*)dp + 2) = b[5];
-        *((Byte*)dp + 3) = b[4];
-        *((Byte*)dp + 4) = b[3];
-        *((Byte*)dp + 5) = b[2];
-        *((Byte*)dp + 6) = b[1];
-        *((Byte*)dp + 7) = b[0];
-#endif
-        
+        memcpy(&d, &v, sizeof(d));
         return d;
       }
       
-      inline Byte read_tagType(gzFile file) {
-        Byte type = read_byte(file);
-        nbt_assert_error(exc_env, file, type >= 0 && type <= TAG_Compound, "Not a valid tag type");
+      inline Byte read_tagType() {
+        Byte type = read_byte();
+        nbt_assert_error(exc_env, type >= 0 && type <= TAG_Int_Array, "Not a valid tag type");
         return type;
       }
       
-      inline void flush_byte_array(gzFile file) {
-        Int length = read_int(file);
-        nbt_assert_error(exc_env, file, gzseek(file, length, SEEK_CUR) != -1,
-          "Buffer to short to flush ByteArray");
+      inline size_t fixed_size(Byte type) {
+        switch (type) {
+        case TAG_Byte: return sizeof(Byte);
+        case TAG_Short: return sizeof(Short);
+        case TAG_Int: return sizeof(Int);
+        case TAG_Long: return sizeof(Long);
+        case TAG_Float: return sizeof(Float);
+        case TAG_Double: return sizeof(Double);
+        default: return 0;
+        }
       }
       
-      inline void handle_byte_array(String name, gzFile file) {
-        Int length = read_int(file);
-        Byte *values = new Byte[length];
-        nbt_assert_error(exc_env, file, gzread(file, values, length) == length, "Buffer to short to read ByteArray");
-        ByteArray *array = new ByteArray();
-        array->values = values;
-        array->length = length;
-        register_byte_array(context, name, array);
+      /*
+       * skip over the payload of a tag without delivering anything,
+       * using length prefixes wherever possible.
+       */
+      void skip_payload(Byte type, int depth) {
+        nbt_assert_error(exc_env, depth < NBT_STACK_SIZE, "Stack cannot be larger than NBT_STACK_SIZE");
+        
+        switch (type) {
+        case TAG_Byte_Array:
+          flush_byte_array();
+          break;
+        case TAG_Int_Array:
+          flush_int_array();
+          break;
+        case TAG_String:
+          flush_string();
+          break;
+        case TAG_List:
+          {
+            Byte list_type = read_tagType();
+            Int list_count = read_int();
+            size_t size = fixed_size(list_type);
+            
+            if (size != 0) {
+              if (list_count > 0) {
+                nbt_assert_error(exc_env, size_t(list_count) <= size_t(end - pos) / size,
+                  "Buffer too short to flush List");
+                pos += size * list_count;
+              }
+              
+              break;
+            }
+            
+            for (Int i = 0; i < list_count; i++) {
+              skip_payload(list_type, depth + 1);
+            }
+          }
+          break;
+        case TAG_Compound:
+          while (true) {
+            Byte child = read_tagType();
+            
+            if (child == TAG_End) {
+              break;
+            }
+            
+            flush_string();
+            skip_payload(child, depth + 1);
+          }
+          break;
+        default:
+          skip(fixed_size(type), "Buffer too short to flush value");
+          break;
+        }
       }
-    public:
-      typedef void (*begin_compound_t)(C*, String name);
-      typedef void (*end_compound_t)(C*, String name);
       
-      typedef void (*begin_list_t)(C*, String name, Byte type, Int length);
-      typedef void (*end_list_t)(C*, String name);
+      /*
+       * if values of type are passed to the handler at all
+       */
+      inline bool delivers(Byte type) {
+        switch (type) {
+        case TAG_Long: return H::has_long && handler.wants(TAG_Long);
+        case TAG_Short: return H::has_short && handler.wants(TAG_Short);
+        case TAG_String: return H::has_string && handler.wants(TAG_String);
+        case TAG_Float: return H::has_float && handler.wants(TAG_Float);
+        case TAG_Double: return H::has_double && handler.wants(TAG_Double);
+        case TAG_Int: return H::has_int && handler.wants(TAG_Int);
+        case TAG_Byte: return H::has_byte && handler.wants(TAG_Byte);
+        case TAG_Byte_Array: return H::has_byte_array && handler.wants(TAG_Byte_Array);
+        default: return true;
+        }
+      }
       
-      typedef void (*register_long_t)(C*, String name, Long l);
-      typedef void (*register_short_t)(C*, String name, Short l);
-      typedef void (*register_string_t)(C*, String name, String l);
-      typedef void (*register_float_t)(C*, String name, Float l);
-      typedef void (*register_double_t)(C*, String name, Double l);
-      typedef void (*register_int_t)(C*, String name, Int l);
-      typedef void (*register_byte_t)(C*, String name, Byte b);
-      typedef void (*register_byte_array_t)(C*, String name, ByteArray* array);
-      typedef void (*error_handler_t)(C*, size_t where, const char *why);
+      inline void flush_byte_array() {
+        Int length = read_int();
+        nbt_assert_error(exc_env, length >= 0, "ByteArray specified with invalid length < 0");
+        skip(length, "Buffer to short to flush ByteArray");
+      }
       
-      register_long_t register_long;
-      register_short_t register_short;
-      register_string_t register_string;
-      register_float_t register_float;
-      register_double_t register_double;
-      register_int_t register_int;
-      register_byte_t register_byte;
-      register_byte_array_t register_byte_array;
-
-      begin_compound_t begin_compound;
-      end_compound_t end_compound;
-      begin_list_t begin_list;
-      end_list_t end_list;
-      error_handler_t error_handler;
+      inline void flush_int_array() {
+        Int length = read_int();
+        nbt_assert_error(exc_env, length >= 0, "IntArray specified with invalid length < 0");
+        nbt_assert_error(exc_env, size_t(length) <= size_t(end - pos) / sizeof(Int), "Buffer to short to flush IntArray");
+        pos += length * sizeof(Int);
+      }
       
-      Parser() :
-        context(NULL),
-        register_long(NULL),
-        register_short(NULL),
-        register_string(NULL),
-        register_float(NULL),
-        register_double(NULL),
-        register_int(NULL),
-        register_byte(NULL),
-        register_byte_array(NULL),
-        begin_compound(&default_begin_compound<C>),
-        end_compound(&default_end_compound<C>),
-        begin_list(&default_begin_list<C>),
-        end_list(&default_end_list<C>),
-        error_handler(&default_error_handler<C>)
-      {
+      inline void handle_byte_array(const Name& name) {
+        Int length = read_int();
+        nbt_assert_error(exc_env, length >= 0, "ByteArray specified with invalid length < 0");
+        nbt_assert_error(exc_env, size_t(length) <= size_t(end - pos), "Buffer to short to read ByteArray");
+        ByteArray *array = new ByteArray();
+        
+        if (zero_copy) {
+          array->values = reinterpret_cast<Byte*>(const_cast<uint8_t*>(pos));
+          array->owned = false;
+        }
+        else {
+          array->values = new Byte[length];
+          memcpy(array->values, pos, length);
+        }
+        
+        array->length = length;
+        pos += length;
+        handler.register_byte_array(name, array);
       }
+    public:
+      /*
+       * hand out byte arrays as views into the parsed buffer instead of
+       * copying them, the buffer must then outlive the arrays.
+       */
+      bool zero_copy;
       
-      Parser(C *context) :
-        context(context),
-        register_long(NULL),
-        register_short(NULL),
-        register_string(NULL),
-        register_float(NULL),
-        register_double(NULL),
-        register_int(NULL),
-        register_byte(NULL),
-        register_byte_array(NULL),
-        begin_compound(&default_begin_compound<C>),
-        end_compound(&default_end_compound<C>),
-        begin_list(&default_begin_list<C>),
-        end_list(&default_end_list<C>),
-        error_handler(&default_error_handler<C>)
+      /*
+       * when set, only the paths in the query are parsed and parsing stops
+       * once all of them have been seen.
+       */
+      const path_query *query;
+      
+      basic_parser(H& handler) :
+        running(false),
+        handler(handler),
+        begin(NULL), pos(NULL), end(NULL),
+        zero_copy(false),
+        query(NULL)
       {
-        this->context = context;
       }
       
       void stop() {
         running = false;
       }
       
+      /**
+       * Inflate the file at `path' into the inflate buffer of the calling
+       * thread and parse it from memory.
+       */
       void parse_file(const char *path)
       {
-        if (setjmp(exc_env) == 1) return;
+        parse_file(path, thread_buffer());
+      }
+      
+      void parse_file(const char *path, buffer& buf)
+      {
+        const char *why = inflate_file(path, buf);
         
-        gzFile file = gzopen(path, "rb");
-        nbt_assert_error(exc_env, file, file != NULL, strerror(errno));
+        if (why != NULL) {
+          handler.error_handler(0, why);
+          return;
+        }
+        
+        parse_buffer(buf.data, buf.size);
+      }
+      
+      /**
+       * Parse an already inflated nbt structure.
+       */
+      void parse_buffer(const uint8_t *data, size_t size)
+      {
+        begin = pos = data;
+        end = data + size;
         
         running = true;
-        stack_entry *stack = new stack_entry[NBT_STACK_SIZE];
         int stack_p = 0;
         stack_entry *root = stack + 0;
         
+        // paths of the query that have been seen in full
+        uint32_t seen = 0;
+        
         if (setjmp(exc_env) == 1) {
-          goto exit_error;
+          return;
         }
         
-        root->type = read_tagType(file);
-        nbt_assert_error(exc_env, file, root->type == TAG_Compound, "Expected TAG_Compound at root");
-        root->name = read_string(file);
+        root->type = read_tagType();
+        nbt_assert_error(exc_env, root->type == TAG_Compound, "Expected TAG_Compound at root");
+        root->name = read_name();
+        root->all = query == NULL;
+        root->mask = query == NULL ? 0 : query->all_mask();
+        root->done = 0;
         
-        begin_compound(context, root->name);
+        handler.begin_compound(root->name);
         
         while(running && stack_p >= 0) {
-          nbt_assert_error(exc_env, file, stack_p < NBT_STACK_SIZE, "Stack cannot be larger than NBT_STACK_SIZE");
-          
           stack_entry* top = stack + stack_p;
           
           Byte type;
-          String name("");
+          Name name;
           
           // if top is of Compound type, we must read the item name first
           if (top->type == TAG_Compound) {
-            type = read_tagType(file);
+            type = read_tagType();
             
             if (type == TAG_End) {
-              end_compound(context, top->name);
+              handler.end_compound(top->name);
               --stack_p;
+              
+              if (top->done != 0 && (seen |= top->done) == query->all_mask()) {
+                running = false;
+              }
+              
               continue;
             }
             
-            name = read_string(file);
+            name = read_name();
           }
           
           // if top of stack is of type list, the type must be inferred, name is assumed to be "" (empty string)
           else if (top->type == TAG_List) {
             if (top->list_read >= top->list_count) {
-              end_list(context, top->name);
+              handler.end_list(top->name);
               --stack_p;
+              
+              if (top->done != 0 && (seen |= top->done) == query->all_mask()) {
+                running = false;
+              }
+              
               continue;
             }
             
@@ -396,82 +817,130 @@ namespace nbt {
           }
           
           else {
-            nbt_assert_error(exc_env, file, 1, "Unknown stack type");
+            nbt_assert_error(exc_env, 0, "Unknown stack type");
             continue;
           }
           
+          /*
+           * match the item against the query, items which are neither
+           * wanted nor on the way to something wanted are skipped.
+           */
+          bool all = true;
+          uint32_t mask = 0, done = 0;
+          
+          if (!top->all) {
+            mask = query->step(top->mask, stack_p, name);
+            all = query->complete(mask, stack_p + 1) != 0;
+            done = query->seen(mask, stack_p + 1);
+            
+            if (!all && (mask == 0 || (type != TAG_Compound && type != TAG_List))) {
+              skip_payload(type, stack_p + 1);
+              continue;
+            }
+          }
+          
           switch(type) {
           case TAG_Long:
-            if (register_long == NULL) {
-              nbt_assert_error(exc_env, file, gzseek(file, sizeof(nbt::Long), SEEK_CUR) != -1,
-                "Buffer too short to flush long");
+            if (!H::has_long || !handler.wants(TAG_Long)) {
+              skip(sizeof(nbt::Long), "Buffer too short to flush long");
             } else {
-              register_long(context, name, read_long(file));
+              handler.register_long(name, read_long());
             }
             break;
           case TAG_Short:
-            if (register_short == NULL) {
-              nbt_assert_error(exc_env, file, gzseek(file, sizeof(nbt::Short), SEEK_CUR) != -1,
-                "Buffer too short to flush short");
+            if (!H::has_short || !handler.wants(TAG_Short)) {
+              skip(sizeof(nbt::Short), "Buffer too short to flush short");
             } else {
-              register_short(context, name, read_short(file));
+              handler.register_short(name, read_short());
             }
             break;
           case TAG_String:
-            if (register_string == NULL) {
-              flush_string(file);
+            if (!H::has_string || !handler.wants(TAG_String)) {
+              flush_string();
             } else {
-              register_string(context, name, read_string(file));
+              handler.register_string(name, read_string());
             }
             break;
           case TAG_Float:
-            if (register_float == NULL) {
-              nbt_assert_error(exc_env, file, gzseek(file, sizeof(nbt::Float), SEEK_CUR) != -1,
-                "Buffer too short to flush float");
+            if (!H::has_float || !handler.wants(TAG_Float)) {
+              skip(sizeof(nbt::Float), "Buffer too short to flush float");
             } else {
-              register_float(context, name, read_float(file));
+              handler.register_float(name, read_float());
             }
             break;
           case TAG_Double:
-            if (register_double == NULL) {
-              nbt_assert_error(exc_env, file, gzseek(file, sizeof(nbt::Double), SEEK_CUR) != -1,
-                "Buffer too short to flush double");
+            if (!H::has_double || !handler.wants(TAG_Double)) {
+              skip(sizeof(nbt::Double), "Buffer too short to flush double");
             } else {
-              register_double(context, name, read_double(file));
+              handler.register_double(name, read_double());
             }
             break;
           case TAG_Int:
-            if (register_int == NULL) {
-              nbt_assert_error(exc_env, file, gzseek(file, sizeof(nbt::Int), SEEK_CUR) != -1,
-                "Buffer too short to flush int");
+            if (!H::has_int || !handler.wants(TAG_Int)) {
+              skip(sizeof(nbt::Int), "Buffer too short to flush int");
             } else {
-              register_int(context, name, read_int(file));
+              handler.register_int(name, read_int());
             }
             break;
           case TAG_Byte:
-            if (register_byte == NULL) {
-              nbt_assert_error(exc_env, file, gzseek(file, sizeof(nbt::Byte), SEEK_CUR) != -1,
-                "Buffer too short to flush byte");
+            if (!H::has_byte || !handler.wants(TAG_Byte)) {
+              skip(sizeof(nbt::Byte), "Buffer too short to flush byte");
             } else {
-              register_byte(context, name, read_byte(file));
+              handler.register_byte(name, read_byte());
             }
             break;
           case TAG_List:
             {
+              Byte list_type = read_tagType();
+              Int list_count = read_int();
+              size_t size = fixed_size(list_type);
+              
+              /*
+               * lists of fixed size values are handed out or skipped in one
+               * step instead of item by item.
+               */
+              if (size != 0) {
+                ListArray array;
+                array.type = list_type;
+                array.length = list_count > 0 ? list_count : 0;
+                array.data = pos;
+                
+                nbt_assert_error(exc_env, size_t(array.length) <= size_t(end - pos) / size,
+                  "Buffer too short to read List");
+                
+                if (H::has_list_array && handler.wants(TAG_List)) {
+                  pos += size * array.length;
+                  handler.register_list_array(name, array);
+                  break;
+                }
+                
+                if (!delivers(list_type)) {
+                  handler.begin_list(name, list_type, list_count);
+                  pos += size * array.length;
+                  handler.end_list(name);
+                  break;
+                }
+              }
+              
+              nbt_assert_error(exc_env, stack_p + 1 < NBT_STACK_SIZE, "Stack cannot be larger than NBT_STACK_SIZE");
               stack_entry* c = stack + ++stack_p;
               
               c->list_read = 0;
-              c->list_type = read_tagType(file);
-              c->list_count = read_int(file);
+              c->list_type = list_type;
+              c->list_count = list_count;
               c->name = name;
               c->type = TAG_List;
+              c->all = all;
+              c->mask = mask;
+              c->done = done;
               
-              begin_list(context, name, c->list_type, c->list_count);
+              handler.begin_list(name, c->list_type, c->list_count);
             }
-            break;
+            continue;
           case TAG_Compound:
             {
-              begin_compound(context, name);
+              nbt_assert_error(exc_env, stack_p + 1 < NBT_STACK_SIZE, "Stack cannot be larger than NBT_STACK_SIZE");
+              handler.begin_compound(name);
               stack_entry* c = stack + ++stack_p;
               
               c->list_read = 0;
@@ -479,24 +948,211 @@ namespace nbt {
               c->list_type = -1;
               c->name = name;
               c->type = TAG_Compound;
+              c->all = all;
+              c->mask = mask;
+              c->done = done;
             }
-            break;
+            continue;
           case TAG_Byte_Array:
-            if (register_byte_array == NULL) {
-              flush_byte_array(file);
+            if (!H::has_byte_array || !handler.wants(TAG_Byte_Array)) {
+              flush_byte_array();
             } else {
-              handle_byte_array(name, file);
+              handle_byte_array(name);
             }
             break;
+          case TAG_Int_Array:
+            // nothing reads these (yet), e.g. the HeightMap of Anvil chunks
+            flush_int_array();
+            break;
           default:
-            nbt_assert_error(exc_env, file, 0, "Encountered unknown type");
+            nbt_assert_error(exc_env, 0, "Encountered unknown type");
             break;
           }
+          
+          if (done != 0 && (seen |= done) == query->all_mask()) {
+            running = false;
+          }
         }
-        
-exit_error:
-        gzclose(file);
-        delete [] stack;
+      }
+  };
+  
+  template <class C>
+  void default_error_handler(C* context, size_t where, const char *why) {
+    std::cerr << "Unhandled nbt parser error at byte " << where << ": " << why << std::endl;
+    exit(1);
+  }
+  
+  template <class C>
+  class Parser;
+  
+  /*
+   * basic_parser handler forwarding every event to the function pointers
+   * of a Parser.
+   */
+  template <class C>
+  struct callback_handler : null_handler {
+    static const bool has_long = true;
+    static const bool has_short = true;
+    static const bool has_string = true;
+    static const bool has_float = true;
+    static const bool has_double = true;
+    static const bool has_int = true;
+    static const bool has_byte = true;
+    static const bool has_byte_array = true;
+    static const bool has_list_array = true;
+    
+    Parser<C>* parser;
+    
+    callback_handler(Parser<C>* parser) : parser(parser) {
+    }
+    
+    inline bool wants(Byte type) {
+      switch (type) {
+      case TAG_Long: return parser->register_long != NULL;
+      case TAG_Short: return parser->register_short != NULL;
+      case TAG_String: return parser->register_string != NULL;
+      case TAG_Float: return parser->register_float != NULL;
+      case TAG_Double: return parser->register_double != NULL;
+      case TAG_Int: return parser->register_int != NULL;
+      case TAG_Byte: return parser->register_byte != NULL;
+      case TAG_Byte_Array: return parser->register_byte_array != NULL;
+      case TAG_List: return parser->register_list_array != NULL;
+      default: return true;
+      }
+    }
+    
+    /*
+     * the names are only turned into strings for callbacks which are set,
+     * the values are only delivered to those anyway (see wants).
+     */
+    inline void begin_compound(const Name& name) {
+      if (parser->begin_compound != NULL) parser->begin_compound(parser->context, name.str());
+    }
+    
+    inline void end_compound(const Name& name) {
+      if (parser->end_compound != NULL) parser->end_compound(parser->context, name.str());
+    }
+    
+    inline void begin_list(const Name& name, Byte type, Int length) {
+      if (parser->begin_list != NULL) parser->begin_list(parser->context, name.str(), type, length);
+    }
+    
+    inline void end_list(const Name& name) {
+      if (parser->end_list != NULL) parser->end_list(parser->context, name.str());
+    }
+    
+    inline void register_long(const Name& name, Long l) { parser->register_long(parser->context, name.str(), l); }
+    inline void register_short(const Name& name, Short s) { parser->register_short(parser->context, name.str(), s); }
+    inline void register_string(const Name& name, const String& s) { parser->register_string(parser->context, name.str(), s); }
+    inline void register_float(const Name& name, Float f) { parser->register_float(parser->context, name.str(), f); }
+    inline void register_double(const Name& name, Double d) { parser->register_double(parser->context, name.str(), d); }
+    inline void register_int(const Name& name, Int i) { parser->register_int(parser->context, name.str(), i); }
+    inline void register_byte(const Name& name, Byte b) { parser->register_byte(parser->context, name.str(), b); }
+    inline void register_byte_array(const Name& name, ByteArray* array) { parser->register_byte_array(parser->context, name.str(), array); }
+    inline void register_list_array(const Name& name, const ListArray& array) { parser->register_list_array(parser->context, name.str(), array); }
+    
+    inline void error_handler(size_t where, const char *why) { parser->error_handler(parser->context, where, why); }
+  };
+  
+  /**
+   * Parser delivering events through function pointers, as a thin adapter
+   * over basic_parser.
+   */
+  template <class C>
+  class Parser {
+    private:
+      friend struct callback_handler<C>;
+      
+      C *context;
+      callback_handler<C> handler;
+      basic_parser<callback_handler<C> > engine;
+      
+      Parser(const Parser&);
+      Parser& operator=(const Parser&);
+    public:
+      typedef void (*begin_compound_t)(C*, String name);
+      typedef void (*end_compound_t)(C*, String name);
+      
+      typedef void (*begin_list_t)(C*, String name, Byte type, Int length);
+      typedef void (*end_list_t)(C*, String name);
+      
+      typedef void (*register_long_t)(C*, String name, Long l);
+      typedef void (*register_short_t)(C*, String name, Short l);
+      typedef void (*register_string_t)(C*, String name, String l);
+      typedef void (*register_float_t)(C*, String name, Float l);
+      typedef void (*register_double_t)(C*, String name, Double l);
+      typedef void (*register_int_t)(C*, String name, Int l);
+      typedef void (*register_byte_t)(C*, String name, Byte b);
+      typedef void (*register_byte_array_t)(C*, String name, ByteArray* array);
+      typedef void (*register_list_array_t)(C*, String name, const ListArray& array);
+      typedef void (*error_handler_t)(C*, size_t where, const char *why);
+      
+      register_long_t register_long;
+      register_short_t register_short;
+      register_string_t register_string;
+      register_float_t register_float;
+      register_double_t register_double;
+      register_int_t register_int;
+      register_byte_t register_byte;
+      register_byte_array_t register_byte_array;
+      register_list_array_t register_list_array;
+
+      begin_compound_t begin_compound;
+      end_compound_t end_compound;
+      begin_list_t begin_list;
+      end_list_t end_list;
+      error_handler_t error_handler;
+      
+      // see basic_parser::zero_copy
+      bool zero_copy;
+      
+      // see basic_parser::query
+      const path_query *query;
+      
+      Parser(C *context = NULL) :
+        context(context),
+        handler(this),
+        engine(handler),
+        register_long(NULL),
+        register_short(NULL),
+        register_string(NULL),
+        register_float(NULL),
+        register_double(NULL),
+        register_int(NULL),
+        register_byte(NULL),
+        register_byte_array(NULL),
+        register_list_array(NULL),
+        begin_compound(NULL),
+        end_compound(NULL),
+        begin_list(NULL),
+        end_list(NULL),
+        error_handler(&default_error_handler<C>),
+        zero_copy(false),
+        query(NULL)
+      {
+      }
+      
+      void stop() {
+        engine.stop();
+      }
+      
+      void parse_file(const char *path)
+      {
+        parse_file(path, thread_buffer());
+      }
+      
+      void parse_file(const char *path, buffer& buf)
+      {
+        engine.zero_copy = zero_copy;
+        engine.query = query;
+        engine.parse_file(path, buf);
+      }
+      
+      void parse_buffer(const uint8_t *data, size_t size)
+      {
+        engine.zero_copy = zero_copy;
+        engine.query = query;
+        engine.parse_buffer(data, size);
       }
   };
 }
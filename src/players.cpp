@@ -2,43 +2,45 @@
 // (C) Copyright 2010 John-John Tedro et al.
 #include "players.h"
 
-void error_handler(player *p, size_t where, const char* why) {
-  p->grammar_error = true;
-}
+static const nbt::NameKey Pos_key("Pos");
 
-void begin_list(player *p, std::string name, nbt::Byte, nbt::Int) {
-  if (name.compare("Pos") == 0) {
-    p->in_pos = true;
+/*
+ * Handler picking the position out of a player file, only the Pos of the
+ * player itself gets to it (not the one of what it is riding, say).
+ */
+struct player_handler : nbt::null_handler {
+  static const bool has_list_array = true;
+  
+  player *p;
+  
+  player_handler(player *p) : p(p) {
   }
-}
-
-void end_list(player *p, std::string name) {
-  if (name.compare("Pos") == 0) {
-    p->in_pos = false;
+  
+  inline void error_handler(size_t where, const char* why) {
+    p->grammar_error = true;
   }
-}
-
-void register_double(player *p, std::string name, nbt::Double value) {
-  if (p->in_pos) {
-    switch (p->pos_c) {
-      case 0: p->xPos = value; break;
-      case 1: p->yPos = value; break;
-      case 2: p->zPos = value; break;
+  
+  inline void register_list_array(const nbt::Name& name, const nbt::ListArray& array) {
+    if (name != Pos_key || array.type != nbt::TAG_Double) {
+      return;
     }
     
-    p->pos_c++;
+    if (array.length > 0) p->xPos = array.double_at(0);
+    if (array.length > 1) p->yPos = array.double_at(1);
+    if (array.length > 2) p->zPos = array.double_at(2);
   }
-}
+};
 
 player::player(const fs::path path) :
   path(path),
-  name(fs::basename(path)), grammar_error(false), in_pos(false),
-  pos_c(0), xPos(0), yPos(0), zPos(0)
+  name(fs::basename(path)), grammar_error(false),
+  xPos(0), yPos(0), zPos(0)
 {
-  nbt::Parser<player> parser(this);
-  parser.error_handler = error_handler;
-  parser.begin_list = begin_list;
-  parser.end_list = end_list;
-  parser.register_double = register_double;
+  nbt::path_query query;
+  query.add("Pos");
+  
+  player_handler handler(this);
+  nbt::basic_parser<player_handler> parser(handler);
+  parser.query = &query;
   parser.parse_file(path.string().c_str());
 }
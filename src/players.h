@@ -22,8 +22,6 @@ public:
   std::string name;
 
   bool grammar_error;
-  bool in_pos;
-  int pos_c;
   nbt::Int xPos, yPos, zPos;
   
   player(const fs::path path);
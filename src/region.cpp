@@ -0,0 +1,410 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#include "region.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+region_file::region_file(const fs::path path, int x, int z, bool mapped)
+  : data(NULL), size(0), mapped(mapped), path(path), x(x), z(z),
+    anvil(fs::extension(path).compare(".mca") == 0), error(NULL)
+{
+#if !defined(_WIN32)
+  int fd = open(path.string().c_str(), O_RDONLY);
+
+  if (fd == -1) {
+    error = strerror(errno);
+    return;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) == -1) {
+    error = strerror(errno);
+    close(fd);
+    return;
+  }
+
+  if (size_t(st.st_size) < HEADER_SIZE) {
+    error = "Region file too short to hold a header";
+    close(fd);
+    return;
+  }
+
+  if (!mapped) {
+    uint8_t *header = reinterpret_cast<uint8_t*>(malloc(HEADER_SIZE));
+
+    if (header == NULL) {
+      error = "Failed to allocate region buffer";
+      close(fd);
+      return;
+    }
+
+    if (pread(fd, header, HEADER_SIZE, 0) != ssize_t(HEADER_SIZE)) {
+      error = "Failed to read region header";
+      free(header);
+      close(fd);
+      return;
+    }
+
+    close(fd);
+    data = header;
+    size = st.st_size;
+    return;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+  // the mapping stays valid after the descriptor is gone
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    error = strerror(errno);
+    return;
+  }
+
+  data = reinterpret_cast<const uint8_t*>(map);
+  size = st.st_size;
+#else
+  FILE *fp = fopen(path.string().c_str(), "rb");
+
+  if (fp == NULL) {
+    error = strerror(errno);
+    return;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long length = ftell(fp);
+  rewind(fp);
+
+  if (length < long(HEADER_SIZE)) {
+    error = "Region file too short to hold a header";
+    fclose(fp);
+    return;
+  }
+
+  uint8_t *contents = reinterpret_cast<uint8_t*>(malloc(length));
+
+  if (contents == NULL) {
+    error = "Failed to allocate region buffer";
+    fclose(fp);
+    return;
+  }
+
+  if (fread(contents, 1, length, fp) != size_t(length)) {
+    error = "Failed to read region file";
+    free(contents);
+    fclose(fp);
+    return;
+  }
+
+  fclose(fp);
+  data = contents;
+  size = length;
+#endif
+}
+
+region_file::~region_file() {
+  if (data == NULL) {
+    return;
+  }
+
+#if !defined(_WIN32)
+  if (mapped) {
+    munmap(const_cast<uint8_t*>(data), size);
+    return;
+  }
+#endif
+
+  free(const_cast<uint8_t*>(data));
+}
+
+inline uint32_t region_file::location(int x, int z) const {
+  size_t i = (x & (WIDTH - 1)) + (z & (WIDTH - 1)) * WIDTH;
+  return nbt::detail::load32(data + i * 4);
+}
+
+bool region_file::has_chunk(int x, int z) const {
+  if (data == NULL) {
+    return false;
+  }
+
+  return location(x, z) != 0;
+}
+
+std::time_t region_file::get_timestamp(int x, int z) const {
+  if (data == NULL) {
+    return 0;
+  }
+
+  size_t i = (x & (WIDTH - 1)) + (z & (WIDTH - 1)) * WIDTH;
+  return nbt::detail::load32(data + SECTOR_SIZE + i * 4);
+}
+
+size_t region_file::read_at(size_t offset, uint8_t* out, size_t length) const {
+#if !defined(_WIN32)
+  if (!mapped) {
+    int fd = open(path.string().c_str(), O_RDONLY);
+
+    if (fd == -1) {
+      return 0;
+    }
+
+    // the file may have been cut short since the header was read
+    size_t done = 0;
+
+    while (done < length) {
+      ssize_t n = pread(fd, out + done, length - done, offset + done);
+
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+
+      if (n <= 0) {
+        break;
+      }
+
+      done += n;
+    }
+
+    close(fd);
+    return done;
+  }
+#endif
+
+  if (offset >= size) {
+    return 0;
+  }
+
+  length = std::min(length, size - offset);
+  memcpy(out, data + offset, length);
+  return length;
+}
+
+const char* region_file::find_sectors(int x, int z, size_t& start, size_t& count) const {
+  start = 0;
+  count = 0;
+
+  if (data == NULL) {
+    return error;
+  }
+
+  uint32_t loc = location(x, z);
+
+  if (loc == 0) {
+    return "Chunk is not present in region";
+  }
+
+  start = size_t(loc >> 8) * SECTOR_SIZE;
+  count = loc & 0xff;
+
+  if (start < HEADER_SIZE || start + 5 > size) {
+    return "Chunk location outside of region file";
+  }
+
+  return NULL;
+}
+
+const char* region_file::find_chunk(int x, int z, nbt::buffer* sectors, const uint8_t*& chunk, size_t& offset, size_t& length) const {
+  chunk = NULL;
+  offset = 0;
+  length = 0;
+
+  size_t start, count;
+  const char *why = find_sectors(x, z, start, count);
+
+  if (why != NULL) {
+    return why;
+  }
+
+  // the header and the data of the chunk come in with the one read
+  const uint8_t *base;
+  size_t available;
+  uint8_t header[5];
+
+  if (mapped) {
+    base = data + start;
+    available = size - start;
+  }
+  else if (sectors != NULL) {
+    if (!sectors->reserve(count * SECTOR_SIZE)) {
+      return "Failed to allocate read buffer";
+    }
+
+    base = sectors->data;
+    available = read_at(start, sectors->data, count * SECTOR_SIZE);
+  }
+  else {
+    base = header;
+    available = read_at(start, header, sizeof(header));
+  }
+
+  if (available < 5) {
+    return "Chunk location outside of region file";
+  }
+
+  size_t stored = nbt::detail::load32(base);
+
+  // the length includes the compression type byte
+  if (stored < 1 || stored + 4 > count * SECTOR_SIZE || start + 4 + stored > size) {
+    return "Chunk length outside of its sectors";
+  }
+
+  if (base != header && stored + 4 > available) {
+    return "Chunk cut short in region file";
+  }
+
+  if (base[4] != COMPRESSION_GZIP && base[4] != COMPRESSION_ZLIB) {
+    return "Unknown chunk compression type";
+  }
+
+  if (base != header) {
+    chunk = base + 5;
+  }
+
+  offset = start + 5;
+  length = stored - 1;
+  return NULL;
+}
+
+const char* region_file::read_chunk(int x, int z, nbt::buffer& out) const {
+  const uint8_t *chunk;
+  size_t offset, length;
+
+  if (mapped) {
+    const char *why = find_chunk(x, z, NULL, chunk, offset, length);
+
+    if (why != NULL) {
+      return why;
+    }
+
+    return nbt::inflate_buffer(chunk, length, out);
+  }
+
+  // `out' may well be the thread buffer, so the compressed data goes into
+  // one of its own
+  nbt::buffer *sectors = nbt::acquire_buffer();
+  const char *why = find_chunk(x, z, sectors, chunk, offset, length);
+
+  if (why == NULL) {
+    why = nbt::inflate_buffer(chunk, length, out);
+  }
+
+  nbt::release_buffer(sectors);
+  return why;
+}
+
+const char* region_file::read_raw(int x, int z, nbt::buffer& out) const {
+  const uint8_t *chunk;
+  size_t offset, length;
+
+  // read in place and moved to the front
+  const char *why = find_chunk(x, z, mapped ? NULL : &out, chunk, offset, length);
+
+  if (why != NULL) {
+    return why;
+  }
+
+  if (mapped) {
+    if (!out.reserve(length)) {
+      return "Failed to allocate read buffer";
+    }
+
+    memcpy(out.data, chunk, length);
+  }
+  else {
+    memmove(out.data, chunk, length);
+  }
+
+  out.size = length;
+  return NULL;
+}
+
+const char* region_file::locate_chunk(int x, int z, size_t& offset, size_t& length) const {
+  const uint8_t *chunk;
+  return find_chunk(x, z, NULL, chunk, offset, length);
+}
+
+bool region_file::will_need(int x, int z) const {
+#if !defined(_WIN32)
+  if (!mapped) {
+#  if defined(POSIX_FADV_WILLNEED)
+    size_t start, count;
+
+    // the sectors of the chunk are enough to go on, without reading any
+    if (find_sectors(x, z, start, count) != NULL) {
+      return false;
+    }
+
+    int fd = open(path.string().c_str(), O_RDONLY);
+
+    if (fd == -1) {
+      return false;
+    }
+
+    int result = posix_fadvise(fd, start, count * SECTOR_SIZE, POSIX_FADV_WILLNEED);
+    close(fd);
+    return result == 0;
+#  else
+    return false;
+#  endif
+  }
+
+  const uint8_t *chunk;
+  size_t offset, length;
+
+  if (find_chunk(x, z, NULL, chunk, offset, length) != NULL) {
+    return false;
+  }
+
+  // the mapping starts on a page, so the chunk is advised from the page it
+  // starts in
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t begin = offset / page * page;
+
+  return madvise(const_cast<uint8_t*>(data + begin), offset - begin + length, MADV_WILLNEED) == 0;
+#else
+  return false;
+#endif
+}
+
+bool parse_region_name(const fs::path path, int& x, int& z) {
+  std::string extension = fs::extension(path);
+
+  if (extension.compare(".mcr") != 0 && extension.compare(".mca") != 0) {
+    return false;
+  }
+
+  std::vector<std::string> parts;
+  std::string basename = fs::basename(path);
+  boost::split(parts, basename, boost::is_any_of("."));
+
+  if (parts.size() != 3 || parts.at(0).compare("r") != 0) {
+    return false;
+  }
+
+  try {
+    x = boost::lexical_cast<int>(parts.at(1));
+    z = boost::lexical_cast<int>(parts.at(2));
+  } catch(boost::bad_lexical_cast& e) {
+    return false;
+  }
+
+  return true;
+}
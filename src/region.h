@@ -0,0 +1,122 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#ifndef _REGION_H_
+#define _REGION_H_
+
+#include <stdint.h>
+#include <ctime>
+
+#include <boost/filesystem.hpp>
+
+#include "nbt/nbt.h"
+
+namespace fs = boost::filesystem;
+
+/**
+ * A McRegion file (region/r.<x>.<z>.mcr) holding up to 32x32 chunks, or an
+ * Anvil file (r.<x>.<z>.mca) which has the same layout.
+ *
+ * The file starts with a table of 1024 chunk locations counted in 4 KiB
+ * sectors, followed by 1024 modification times. Each chunk is stored as a
+ * big endian length, a compression type and the compressed nbt structure.
+ *
+ * The whole file is mapped into memory when opened, so chunks are inflated
+ * straight from the mapping without any further reads. A file which may be
+ * truncated while it is open (a server is writing the world) is not mapped,
+ * since touching the lost pages would kill the process; only the header is
+ * kept and each chunk is read with pread instead.
+ */
+class region_file {
+  private:
+    // the mapped file, or only its header when not mapped
+    const uint8_t *data;
+    size_t size;
+    const bool mapped;
+
+    region_file(const region_file&);
+    region_file& operator=(const region_file&);
+
+    inline uint32_t location(int x, int z) const;
+
+    // copy up to `length' bytes at `offset' in the file, how many there were
+    size_t read_at(size_t offset, uint8_t* out, size_t length) const;
+
+    // the sectors of a chunk according to the header
+    const char* find_sectors(int x, int z, size_t& start, size_t& count) const;
+
+    /*
+     * where the compressed data of a chunk is in the file. `chunk' points
+     * at it if the file is mapped, or once the sectors of the chunk are read
+     * into `sectors' with a single read when they are given.
+     */
+    const char* find_chunk(int x, int z, nbt::buffer* sectors, const uint8_t*& chunk, size_t& offset, size_t& length) const;
+  public:
+    static const int WIDTH = 32;
+    static const size_t SECTOR_SIZE = 0x1000;
+    static const size_t HEADER_SIZE = 2 * SECTOR_SIZE;
+
+    static const uint8_t COMPRESSION_GZIP = 1;
+    static const uint8_t COMPRESSION_ZLIB = 2;
+
+    const fs::path path;
+    // position in regions, the first chunk is at x * WIDTH, z * WIDTH
+    const int x, z;
+    // chunks are in the section based Anvil format
+    const bool anvil;
+    // set when the file could not be opened
+    const char *error;
+
+    region_file(const fs::path path, int x, int z, bool mapped = true);
+    ~region_file();
+
+    bool is_open() const {
+      return data != NULL;
+    }
+
+    /*
+     * all chunk coordinates below are world chunk coordinates, only the part
+     * within this region is used.
+     */
+    bool has_chunk(int x, int z) const;
+
+    /*
+     * modification time of a chunk, as seconds since the epoch
+     */
+    std::time_t get_timestamp(int x, int z) const;
+
+    /**
+     * Inflate a chunk into `out'.
+     *
+     * Returns NULL on success, or a description of the error.
+     */
+    const char* read_chunk(int x, int z, nbt::buffer& out) const;
+
+    /**
+     * Copy a chunk into `out' without inflating it, which reads it in from
+     * the disk if it isn't already.
+     *
+     * Returns NULL on success, or a description of the error.
+     */
+    const char* read_raw(int x, int z, nbt::buffer& out) const;
+
+    /**
+     * Where the compressed data of a chunk is in the file, for reading it
+     * some other way.
+     *
+     * Returns NULL on success, or a description of the error.
+     */
+    const char* locate_chunk(int x, int z, size_t& offset, size_t& length) const;
+
+    /*
+     * let the kernel know the chunk is about to be read, so that it can start
+     * reading it in. False if that isn't possible.
+     */
+    bool will_need(int x, int z) const;
+};
+
+/*
+ * Parse the region position out of a r.<x>.<z>.mcr or r.<x>.<z>.mca filename.
+ */
+bool parse_region_name(const fs::path path, int& x, int& z);
+
+#endif /* _REGION_H_ */
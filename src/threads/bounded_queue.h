@@ -0,0 +1,113 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#ifndef _BOUNDED_QUEUE_H_
+#define _BOUNDED_QUEUE_H_
+
+#include <map>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+/**
+ * A queue between two stages of threads holding at most capacity items,
+ * pushing to it blocks until the other side catches up.
+ *
+ * Items are numbered by the order they were meant to come in. An ordered
+ * queue hands them out in that order and bounds how far ahead of the next
+ * one the pushing side may get, so that a slow item never keeps the ones
+ * before it out. Otherwise whichever item in the queue comes first goes.
+ */
+template <class T>
+class bounded_queue
+{
+private:
+  std::map<size_t, T> items;
+  
+  const size_t capacity;
+  const bool ordered;
+  // the number of items taken out so far
+  size_t next;
+  bool closed;
+  
+  boost::mutex mutex;
+  boost::condition pushed;
+  boost::condition popped;
+  
+  bool is_full(size_t seq) {
+    if (ordered) {
+      return seq >= next + capacity;
+    }
+    
+    return items.size() >= capacity;
+  }
+  
+  bool is_ready() {
+    if (items.empty()) {
+      return false;
+    }
+    
+    return !ordered || items.begin()->first == next;
+  }
+public:
+  bounded_queue(size_t capacity, bool ordered = true) :
+    capacity(capacity), ordered(ordered), next(0), closed(false)
+  {
+  }
+  
+  /*
+   * push item number seq, waiting for room for it unless wait is unset.
+   * False if there was none, or the queue was closed meanwhile.
+   */
+  bool push(size_t seq, const T& t, bool wait = true) {
+    boost::mutex::scoped_lock lock(mutex);
+    
+    while (wait && !closed && is_full(seq)) {
+      popped.wait(lock);
+    }
+    
+    if (closed || is_full(seq)) {
+      return false;
+    }
+    
+    items.insert(std::make_pair(seq, t));
+    pushed.notify_all();
+    return true;
+  }
+  
+  /*
+   * take the next item out, without waiting for it unless wait is set.
+   * False if there is none.
+   */
+  bool pop(T& t, bool wait = true) {
+    boost::mutex::scoped_lock lock(mutex);
+    
+    while (wait && !closed && !is_ready()) {
+      pushed.wait(lock);
+    }
+    
+    if (closed || !is_ready()) {
+      return false;
+    }
+    
+    t = items.begin()->second;
+    items.erase(items.begin());
+    ++next;
+    popped.notify_all();
+    return true;
+  }
+  
+  bool is_closed() {
+    boost::mutex::scoped_lock lock(mutex);
+    return closed;
+  }
+  
+  // wake everyone up and turn them away, for when the items are abandoned
+  void close() {
+    boost::mutex::scoped_lock lock(mutex);
+    closed = true;
+    pushed.notify_all();
+    popped.notify_all();
+  }
+};
+
+#endif /* _BOUNDED_QUEUE_H_ */
@@ -5,7 +5,10 @@
 #include <assert.h>
 
 #include <queue>
+#include <deque>
+#include <vector>
 #include <list>
+#include <map>
 
 #include <iostream>
 
@@ -16,29 +19,75 @@
 #include <boost/thread.hpp>
 #include <boost/bind.hpp>
 
+/**
+ * A pool of threads running work() on everything given to it.
+ *
+ * Every thread has a queue of its own which jobs are dealt out to, and
+ * threads which run out of jobs steal from the others. Results are handed
+ * back as soon as they are done; if the pool is ordered get() keeps the
+ * ones that came back early until those before them are done, so that a
+ * slow job never holds up the threads.
+ */
 template <class I, class O>
 class threadworker
 {
 private:
-  std::queue<I> in;
-  std::queue<O> out;
+  struct job_queue {
+    boost::mutex mutex;
+    std::deque<std::pair<int, I> > jobs;
+  };
+  
+  std::vector<job_queue*> queues;
   std::list<boost::thread *> threads;
-  boost::condition in_cond;
+  
+  // jobs given but not yet taken, threads sleep while there are none
+  boost::detail::atomic_count pending;
+  boost::condition idle_cond;
+  boost::mutex idle_mutex;
+  
+  std::queue<std::pair<int, O> > out;
   boost::condition out_cond;
-  boost::condition start_cond;
-  boost::condition order_cond;
-  boost::mutex in_mutex;
   boost::mutex out_mutex;
+  
+  boost::condition start_cond;
   boost::mutex start_mutex;
-  boost::mutex order_mutex;
   
   const int thread_count;
+  const bool ordered;
   volatile int running;
   volatile int started;
-  volatile int input;
-  boost::detail::atomic_count output;
+  // only touched by the thread giving and getting
+  int input;
+  int output;
+  std::map<int, O> early;
+  
+  bool take(int id, std::pair<int, I>& job) {
+    // the own queue first, then the others starting with the next one
+    for (int n = 0; n < thread_count; n++) {
+      job_queue* q = queues[(id + n) % thread_count];
+      
+      boost::mutex::scoped_lock lock(q->mutex);
+      
+      if (q->jobs.empty()) {
+        continue;
+      }
+      
+      job = q->jobs.front();
+      q->jobs.pop_front();
+      --pending;
+      return true;
+    }
+    
+    return false;
+  }
 public:
-  threadworker(int c) : thread_count(c), running(1), started(0), input(0), output(1) {
+  threadworker(int c, bool ordered = true) :
+    pending(0), thread_count(c), ordered(ordered), running(1), started(0), input(0), output(0)
+  {
+    for (int i = 0; i < c; i++) {
+      queues.push_back(new job_queue());
+    }
+    
     for (int i = 0; i < c; i++) {
       boost::thread *t = new boost::thread(boost::bind(&threadworker::run, this, i));
       threads.push_back(t);
@@ -50,12 +99,26 @@ public:
     {
       delete *it;
     }
+    
+    for (typename std::vector<job_queue*>::iterator it = queues.begin(); it != queues.end(); it++)
+    {
+      delete *it;
+    }
   }
   
   void give(I t) {
-    boost::mutex::scoped_lock lock(in_mutex);
-    in.push(t);
-    in_cond.notify_one();
+    int qp = input++;
+    
+    {
+      job_queue* q = queues[qp % thread_count];
+      boost::mutex::scoped_lock lock(q->mutex);
+      q->jobs.push_back(std::make_pair(qp, t));
+    }
+    
+    ++pending;
+    
+    boost::mutex::scoped_lock lock(idle_mutex);
+    idle_cond.notify_one();
   }
   
   void start() {
@@ -74,49 +137,55 @@ public:
     }
     
     while (running) {
-      I i;
-
-      int qp;
+      std::pair<int, I> job;
       
-      {
-        boost::mutex::scoped_lock lock(in_mutex);
+      if (!take(id, job)) {
+        boost::mutex::scoped_lock lock(idle_mutex);
         
-        while (running && in.empty()) {
-          in_cond.wait(lock);
+        while (running && pending == 0) {
+          idle_cond.wait(lock);
         }
         
-        if (!running) {
-          return;
-        }
-        
-        i = in.front();
-        in.pop();
-        qp = ++input;
+        continue;
       }
       
-      O o = work(i);
+      O o = work(job.second);
       
       {
-        // first, make sure that we output the results in the same order they came in
-        // try to make it as lock-free as possible
         boost::mutex::scoped_lock lock(out_mutex);
-        
-        while (qp != output) {
-          order_cond.wait(out_mutex);
-        }
-        
-        out.push(o);
+        out.push(std::make_pair(job.first, o));
         out_cond.notify_one();
-        ++output;
-        order_cond.notify_all();
       }
     }
   }
-
+  
   virtual O work(I) = 0;
   
+  /*
+   * the next result, in the order the jobs were given if the pool is
+   * ordered and otherwise as soon as any is done.
+   */
   O get() {
-    O o;
+    if (ordered) {
+      typename std::map<int, O>::iterator it;
+      
+      while ((it = early.find(output)) == early.end()) {
+        boost::mutex::scoped_lock lock(out_mutex);
+        
+        while (out.empty()) {
+          out_cond.wait(lock);
+        }
+        
+        for (; !out.empty(); out.pop()) {
+          early.insert(out.front());
+        }
+      }
+      
+      O o = it->second;
+      early.erase(it);
+      ++output;
+      return o;
+    }
     
     boost::mutex::scoped_lock lock(out_mutex);
     
@@ -124,18 +193,18 @@ public:
       out_cond.wait(lock);
     }
     
-    o = out.front();
+    O o = out.front().second;
     out.pop();
-    
+    ++output;
     return o;
   }
-
+  
   void join() {
     running = 0;
     
     {
-      boost::mutex::scoped_lock lock(in_mutex);
-      in_cond.notify_all();
+      boost::mutex::scoped_lock lock(idle_mutex);
+      idle_cond.notify_all();
     }
     
     for (std::list<boost::thread *>::iterator it = threads.begin(); it != threads.end(); it++)
@@ -153,7 +222,7 @@ private:
   
   const int thread_count;
 public:
-  threadworker(int c) : thread_count(c) {
+  threadworker(int c, bool ordered = true) : thread_count(c) {
   }
   
   virtual ~threadworker() {
@@ -168,7 +237,7 @@ public:
   
   void run(int id) {
   }
-
+  
   virtual O work(I) = 0;
   
   O get() {
@@ -0,0 +1,98 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#ifndef _WAVEFRONT_H_
+#define _WAVEFRONT_H_
+
+#include <vector>
+
+#if !defined(C10T_DISABLE_THREADS)
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#endif
+
+/**
+ * Lets the jobs of a number of waves run a wave at a time, every job of a
+ * wave waiting in wait() until all jobs of the waves before it are done().
+ *
+ * Jobs have to be handed to the threads in the order of their waves, or
+ * the threads may end up waiting on each other.
+ */
+class wavefront
+{
+private:
+  // jobs not yet done in every wave
+  std::vector<size_t> left;
+  // the first wave with jobs left
+  size_t current;
+  volatile bool stopped;
+  
+#if !defined(C10T_DISABLE_THREADS)
+  boost::mutex mutex;
+  boost::condition cond;
+#endif
+  
+  void advance() {
+    while (current < left.size() && left[current] == 0) {
+      current++;
+    }
+  }
+public:
+  wavefront() : current(0), stopped(false) {
+  }
+  
+  // one more job in the wave, before any of them are started
+  void add(size_t wave) {
+    if (wave >= left.size()) {
+      left.resize(wave + 1, 0);
+    }
+    
+    left[wave]++;
+  }
+  
+  /*
+   * block until the waves before this one are done, false if the waves
+   * were stopped meanwhile.
+   */
+  bool wait(size_t wave) {
+#if !defined(C10T_DISABLE_THREADS)
+    boost::mutex::scoped_lock lock(mutex);
+    
+    advance();
+    
+    while (!stopped && current < wave) {
+      cond.wait(lock);
+    }
+#endif
+    return !stopped;
+  }
+  
+  void done(size_t wave) {
+#if !defined(C10T_DISABLE_THREADS)
+    boost::mutex::scoped_lock lock(mutex);
+#endif
+    
+    left[wave]--;
+    
+    size_t was = current;
+    advance();
+    
+#if !defined(C10T_DISABLE_THREADS)
+    if (current != was) {
+      cond.notify_all();
+    }
+#endif
+  }
+  
+  // let everyone waiting go, for when the jobs are abandoned
+  void stop() {
+#if !defined(C10T_DISABLE_THREADS)
+    boost::mutex::scoped_lock lock(mutex);
+    stopped = true;
+    cond.notify_all();
+#else
+    stopped = true;
+#endif
+  }
+};
+
+#endif /* _WAVEFRONT_H_ */
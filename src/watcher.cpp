@@ -0,0 +1,190 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#include "watcher.h"
+#include "fileutils.h"
+#include "region.h"
+
+#include <string.h>
+#include <errno.h>
+
+#if defined(C10T_HAVE_INOTIFY)
+#  include <unistd.h>
+#  include <poll.h>
+#  include <dirent.h>
+#  include <sys/stat.h>
+#  include <sys/inotify.h>
+
+/*
+ * the files worth rendering again when they change
+ */
+static bool is_watched_file(const char *name) {
+  int x, z;
+  
+  if (parse_chunk_name(name, x, z)) {
+    return true;
+  }
+  
+  return parse_region_name(fs::path(name), x, z);
+}
+
+// region files are kept open and written in place, so modifications count
+static const uint32_t WATCH_MASK =
+  IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+world_watcher::world_watcher(const fs::path world_path) : fd(-1), error(NULL) {
+  fd = inotify_init();
+  
+  if (fd == -1) {
+    error = strerror(errno);
+    return;
+  }
+  
+  add_tree(world_path.string(), NULL);
+  
+  if (watches.empty()) {
+    error = "Could not watch world directory";
+    close(fd);
+    fd = -1;
+  }
+}
+
+world_watcher::~world_watcher() {
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+void world_watcher::add_tree(const std::string& dir, std::set<std::string>* changed) {
+  int wd = inotify_add_watch(fd, dir.c_str(), WATCH_MASK);
+  
+  if (wd == -1) {
+    return;
+  }
+  
+  watches[wd] = dir;
+  
+  DIR *d = opendir(dir.c_str());
+  
+  if (d == NULL) {
+    return;
+  }
+  
+  struct dirent *ent;
+  
+  while ((ent = readdir(d)) != NULL) {
+    const char *name = ent->d_name;
+    
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+    
+    std::string path = dir + "/" + name;
+    struct stat st;
+    
+    if (stat(path.c_str(), &st) == -1) {
+      continue;
+    }
+    
+    if (S_ISDIR(st.st_mode)) {
+      add_tree(path, changed);
+    }
+    else if (changed != NULL && is_watched_file(name)) {
+      changed->insert(path);
+    }
+  }
+  
+  closedir(d);
+}
+
+bool world_watcher::read_events(std::set<std::string>& changed) {
+  char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+  
+  ssize_t length = read(fd, buffer, sizeof(buffer));
+  
+  if (length <= 0) {
+    return errno == EINTR;
+  }
+  
+  for (char *p = buffer; p < buffer + length; ) {
+    struct inotify_event *event = reinterpret_cast<struct inotify_event*>(p);
+    p += sizeof(struct inotify_event) + event->len;
+    
+    std::map<int, std::string>::iterator it = watches.find(event->wd);
+    
+    if (event->mask & IN_IGNORED) {
+      if (it != watches.end()) watches.erase(it);
+      continue;
+    }
+    
+    if (it == watches.end() || event->len == 0) {
+      continue;
+    }
+    
+    std::string path = it->second + "/" + event->name;
+    
+    // new directories (the fan-out of a growing world) are watched too
+    if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+      add_tree(path, &changed);
+      continue;
+    }
+    
+    if (is_watched_file(event->name)) {
+      changed.insert(path);
+    }
+  }
+  
+  return true;
+}
+
+bool world_watcher::wait(int delay, std::set<std::string>& changed) {
+  if (fd == -1) {
+    return false;
+  }
+  
+  size_t before = changed.size();
+  
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  
+  while (true) {
+    // wait forever for the first change, then until it is quiet
+    int ready = poll(&pfd, 1, changed.size() == before ? -1 : delay);
+    
+    if (ready == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    
+    if (ready == 0) {
+      return true;
+    }
+    
+    if (!read_events(changed)) {
+      return false;
+    }
+  }
+}
+
+#else
+
+world_watcher::world_watcher(const fs::path world_path) :
+  fd(-1), error("c10t was built without inotify support")
+{
+}
+
+world_watcher::~world_watcher() {
+}
+
+void world_watcher::add_tree(const std::string& dir, std::set<std::string>* changed) {
+}
+
+bool world_watcher::read_events(std::set<std::string>& changed) {
+  return false;
+}
+
+bool world_watcher::wait(int delay, std::set<std::string>& changed) {
+  return false;
+}
+
+#endif
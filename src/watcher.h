@@ -0,0 +1,64 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#ifndef _WATCHER_H_
+#define _WATCHER_H_
+
+#include <string>
+#include <map>
+#include <set>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+#if defined(__linux__)
+#  define C10T_HAVE_INOTIFY
+#endif
+
+/**
+ * Watches every directory of a world for chunk and region files being
+ * written, moved or removed, through inotify.
+ *
+ * Only available on Linux, elsewhere the watcher never opens.
+ */
+class world_watcher {
+private:
+  int fd;
+  // watch descriptors and the directories they watch
+  std::map<int, std::string> watches;
+  
+  world_watcher(const world_watcher&);
+  world_watcher& operator=(const world_watcher&);
+  
+  /*
+   * watch dir and everything below it, the files already found in there
+   * are added to `changed' if it is set.
+   */
+  void add_tree(const std::string& dir, std::set<std::string>* changed);
+  
+  /*
+   * read the pending events, false if reading failed.
+   */
+  bool read_events(std::set<std::string>& changed);
+public:
+  // set when the watcher could not be opened
+  const char *error;
+  
+  world_watcher(const fs::path world_path);
+  ~world_watcher();
+  
+  bool is_open() const {
+    return fd != -1;
+  }
+  
+  /**
+   * Block until a chunk or region file changes, then keep collecting
+   * changes until nothing has happened for `delay' milliseconds.
+   *
+   * The full paths of the changed files are added to `changed', returns
+   * false on errors.
+   */
+  bool wait(int delay, std::set<std::string>& changed);
+};
+
+#endif /* _WATCHER_H_ */
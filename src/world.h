@@ -11,39 +11,25 @@
 #include <sstream>
 #include <vector>
 #include <map>
+#include <set>
 
 #include <boost/filesystem.hpp>
-#include <boost/ptr_container/ptr_map.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "fileutils.h"
 #include "global.h"
 #include "common.h"
 #include "level.h"
+#include "region.h"
+#include "world_index.h"
+#include "level_index.h"
 
 namespace fs = boost::filesystem;
 
-void transform_world_xz(int& x, int& z, int rotation);
-
-struct level {
-  int xPos, zPos;
-  int xReal, zReal;
-};
-
-struct world_pos {
-  int x, z;
-  
-  bool operator<(const world_pos& o) const
-  {
-    if (x < o.x) return true;
-    if (x == o.x && z < o.z) return true;
-    return false;
-  }
-};
-
 class world_info {
 public:
   fs::path world_path;
-  std::list<level> levels;
+  level_index levels;
   
   int min_x;
   int min_z;
@@ -51,79 +37,329 @@ public:
   int max_z;
   int chunk_x;
   int chunk_y;
+  // height of the chunks, see mc::chunk_geometry
+  int height;
+  // whether the levels were found in region files
+  bool regions;
+  
+  world_info() : height(mc::alpha_geometry::MapY), regions(false) {
+  }
   
-  static bool compare_levels(level first, level second)
+  world_info(settings_t& s, fs::path world_path, void (*c_progress)(int, int))
+    : world_path(world_path), levels(s.rotation), min_x(INT_MAX), min_z(INT_MAX), max_x(INT_MIN), max_z(INT_MIN), chunk_x(0), chunk_y(0), height(mc::alpha_geometry::MapY), regions(false)
   {
-    if (first.zPos < second.zPos) {
-      return true;
-    }
+    int i = 1;
     
-    if (first.zPos > second.zPos) {
-      return false;
+    // worlds which have been converted to regions only use those
+    regions = scan_regions(s, c_progress, i);
+    
+    if (!regions) {
+      // the index only knows about chunks by name
+      if (s.cache_use && !s.pedantic_broad_phase) {
+        scan_index(s, c_progress, i);
+      }
+      else {
+        scan_chunk_files(s, c_progress, i);
+      }
     }
     
-    return first.xPos < second.xPos;;
+    levels.sort();
+    
+    if (c_progress != NULL) c_progress(i++, 1);
   }
-
-  world_info() {
+  
+  void add_level(settings_t& s, int xPos, int zPos, boost::shared_ptr<region_file> region, const fs::path& path, std::time_t modified = -1) {
+    if (xPos < s.min_x ||
+        xPos > s.max_x ||
+        zPos < s.min_z ||
+        zPos > s.max_z) {
+      
+      if (!s.silent && s.debug) {
+        std::cout << "Ignoring block out of limit range: " << xPos << "," << zPos << " - " << path << std::endl;
+      }
+      
+      return;
+    }
+    
+    levels.add(xPos, zPos, region, modified);
+    
+    transform_world_xz(xPos, zPos, s.rotation);
+    
+    min_x = std::min(min_x, xPos);
+    max_x = std::max(max_x, xPos);
+    min_z = std::min(min_z, zPos);
+    max_z = std::max(max_z, zPos);
   }
   
-  world_info(settings_t& s, fs::path world_path, void (*c_progress)(int, int))
-    : world_path(world_path), min_x(INT_MAX), min_z(INT_MAX), max_x(INT_MIN), max_z(INT_MIN), chunk_x(0), chunk_y(0)
-  {
-    dirlist broadlisting(world_path);
+  /*
+   * broad phase listing of the c.<x>.<z>.dat chunk files, to figure out how
+   * they are ordered.
+   */
+  void scan_chunk_files(settings_t& s, void (*c_progress)(int, int), int& i) {
+    std::vector<chunk_file> files;
     
-    int i = 1;
+    find_chunk_files(world_path, s.threads, files);
     
-    // broad phase listing of all the levels to figure out how they are ordered.
-    while (broadlisting.has_next()) {
+    for (std::vector<chunk_file>::iterator it = files.begin(); it != files.end(); it++) {
       if (c_progress != NULL) c_progress(i++, 0);
       
-      fs::path next = broadlisting.next();
+      if (s.pedantic_broad_phase) {
+        fast_level_file leveldata(it->path, true);
+        
+        if (!leveldata.islevel || leveldata.grammar_error) {
+          continue;
+        }
+        
+        add_level(s, leveldata.xPos, leveldata.zPos, boost::shared_ptr<region_file>(), it->path);
+        continue;
+      }
+      
+      if (!it->named) {
+        continue;
+      }
       
-      fast_level_file leveldata(next, s.pedantic_broad_phase);
+      add_level(s, it->x, it->z, boost::shared_ptr<region_file>(), it->path);
+    }
+  }
+  
+  /*
+   * broad phase out of the world index kept in the cache directory, which is
+   * brought up to date (and written back) first.
+   */
+  void scan_index(settings_t& s, void (*c_progress)(int, int), int& i) {
+    fs::path index_path = s.cache_dir / "world.idx";
+    world_index index(world_path);
+    
+    bool loaded = index.read(index_path);
+    int listed = index.update(s.threads);
+    
+    if (!loaded || listed > 0) {
+      if (!index.write(index_path) && !s.silent && s.debug) {
+        std::cout << "Failed to write world index: " << index_path << std::endl;
+      }
+    }
+    
+    world_index::directory_map::iterator it = index.directories.begin();
+    
+    for (; it != index.directories.end(); it++) {
+      std::vector<world_index::chunk>& chunks = it->second.chunks;
       
-      if (!leveldata.islevel || leveldata.grammar_error) {
+      for (std::vector<world_index::chunk>::iterator c = chunks.begin(); c != chunks.end(); c++) {
+        if (c_progress != NULL) c_progress(i++, 0);
+        add_level(s, c->x, c->z, boost::shared_ptr<region_file>(), it->first, c->modified.sec);
+      }
+    }
+  }
+  
+  /*
+   * broad phase listing of region/r.<x>.<z>.mca or .mcr files, only the
+   * location table of each region is read unless the broad phase is
+   * pedantic.
+   *
+   * Returns false if the world has no region files.
+   */
+  bool scan_regions(settings_t& s, void (*c_progress)(int, int), int& i) {
+    fs::path region_path = world_path / "region";
+    
+    if (!fs::is_directory(region_path)) {
+      return false;
+    }
+    
+    std::vector<fs::path> mcr, mca;
+    
+    fs::directory_iterator end_itr;
+    
+    for (fs::directory_iterator itr(region_path); itr != end_itr; ++itr) {
+      int rx, rz;
+      
+      if (!parse_region_name(itr->path(), rx, rz)) {
         continue;
       }
       
-      if (leveldata.xPos < s.min_x ||
-          leveldata.xPos > s.max_x ||
-          leveldata.zPos < s.min_z ||
-          leveldata.zPos > s.max_z) {
-        
+      if (fs::extension(itr->path()).compare(".mca") == 0) {
+        mca.push_back(itr->path());
+      }
+      else {
+        mcr.push_back(itr->path());
+      }
+    }
+    
+    // the old regions are left behind when a world is converted to anvil
+    std::vector<fs::path>& paths = mca.empty() ? mcr : mca;
+    
+    if (!mca.empty()) {
+      height = mc::anvil_geometry::MapY;
+    }
+    
+    for (std::vector<fs::path>::iterator it = paths.begin(); it != paths.end(); it++) {
+      int rx, rz;
+      
+      parse_region_name(*it, rx, rz);
+      
+      // regions entirely outside of the limits are never opened
+      if ((rx + 1) * region_file::WIDTH <= s.min_x ||
+          rx * region_file::WIDTH > s.max_x ||
+          (rz + 1) * region_file::WIDTH <= s.min_z ||
+          rz * region_file::WIDTH > s.max_z) {
+        continue;
+      }
+      
+      // a watched world is being saved to while it is read, which a mapping
+      // doesn't survive
+      boost::shared_ptr<region_file> region(new region_file(*it, rx, rz, !s.watch));
+      
+      if (!region->is_open()) {
         if (!s.silent && s.debug) {
-          std::cout << "Ignoring block out of limit range: " << leveldata.xPos << "," << leveldata.zPos << " - " << leveldata.path << std::endl;
+          std::cout << "Ignoring unreadable region: " << region->path << " - " << region->error << std::endl;
         }
+        
+        continue;
+      }
       
+      for (int z = 0; z < region_file::WIDTH; z++) {
+        for (int x = 0; x < region_file::WIDTH; x++) {
+          int xPos = rx * region_file::WIDTH + x;
+          int zPos = rz * region_file::WIDTH + z;
+          
+          if (!region->has_chunk(xPos, zPos)) {
+            continue;
+          }
+          
+          if (c_progress != NULL) c_progress(i++, 0);
+          
+          std::time_t modified = region->get_timestamp(xPos, zPos);
+          
+          if (s.pedantic_broad_phase) {
+            fast_level_file leveldata(*region, xPos, zPos);
+            
+            if (!leveldata.islevel || leveldata.grammar_error) {
+              continue;
+            }
+            
+            // levels are found in the region their position points to
+            if (floor_div(leveldata.xPos, region_file::WIDTH) != rx || floor_div(leveldata.zPos, region_file::WIDTH) != rz) {
+              if (!s.silent && s.debug) {
+                std::cout << "Ignoring chunk outside of its region: " << leveldata.xPos << "," << leveldata.zPos << " - " << region->path << std::endl;
+              }
+              
+              continue;
+            }
+            
+            xPos = leveldata.xPos;
+            zPos = leveldata.zPos;
+          }
+          
+          add_level(s, xPos, zPos, region, region->path, modified);
+        }
+      }
+    }
+    
+    return !paths.empty();
+  }
+  
+  /*
+   * bring the levels up to date with chunk files known to have been
+   * written or removed since the broad phase, which is what watching a
+   * world finds out. The positions of the levels that changed are added to
+   * `changed'.
+   */
+  void update_chunk_files(settings_t& s, const std::vector<fs::path>& paths, std::set<std::pair<int, int> >& changed) {
+    std::map<std::pair<int, int>, fs::path> files;
+    
+    for (std::vector<fs::path>::const_iterator it = paths.begin(); it != paths.end(); it++) {
+      int x, z;
+      std::string name = fs::basename(*it) + fs::extension(*it);
+      
+      if (parse_chunk_name(name.c_str(), x, z)) {
+        files[std::make_pair(x, z)] = *it;
+      }
+    }
+    
+    // the levels already known are updated or dropped, in one pass
+    std::vector<std::pair<int, int> > removed;
+    
+    for (size_t i = 0; i < levels.size() && !files.empty(); i++) {
+      level l = levels.get(i);
+      
+      std::map<std::pair<int, int>, fs::path>::iterator f = files.find(std::make_pair(l.xReal, l.zReal));
+      
+      if (f == files.end()) {
         continue;
       }
-
-      level l;
-
-      l.xReal = leveldata.xPos;
-      l.zReal = leveldata.zPos;
-
-      l.xPos = leveldata.xPos;
-      l.zPos = leveldata.zPos;
       
-      transform_world_xz(l.xPos, l.zPos, s.rotation);
-
-      min_x = std::min(min_x, l.xPos);
-      max_x = std::max(max_x, l.xPos);
-      min_z = std::min(min_z, l.zPos);
-      max_z = std::max(max_z, l.zPos);
-
-      levels.push_back(l);
+      changed.insert(std::make_pair(l.xPos, l.zPos));
+      
+      std::time_t modified = get_file_modified(f->second);
+      files.erase(f);
+      
+      if (modified == -1) {
+        removed.push_back(std::make_pair(l.xPos, l.zPos));
+        continue;
+      }
+      
+      levels.set_modified(i, modified);
     }
-
-    levels.sort(compare_levels);
     
-    if (c_progress != NULL) c_progress(i++, 1);
+    if (!removed.empty()) {
+      levels.remove(removed);
+    }
+    
+    // whatever is left is new
+    for (std::map<std::pair<int, int>, fs::path>::iterator f = files.begin(); f != files.end(); f++) {
+      std::time_t modified = get_file_modified(f->second);
+      
+      if (modified == -1) {
+        continue;
+      }
+      
+      int xPos = f->first.first, zPos = f->first.second;
+      
+      add_level(s, xPos, zPos, boost::shared_ptr<region_file>(), f->second, modified);
+      
+      transform_world_xz(xPos, zPos, s.rotation);
+      changed.insert(std::make_pair(xPos, zPos));
+    }
+    
+    levels.sort();
+    
+    // removed levels may shrink the world
+    min_x = INT_MAX, min_z = INT_MAX, max_x = INT_MIN, max_z = INT_MIN;
+    
+    for (size_t i = 0; i < levels.size(); i++) {
+      const level_index::entry& e = levels[i];
+      min_x = std::min(min_x, int(e.x));
+      max_x = std::max(max_x, int(e.x));
+      min_z = std::min(min_z, int(e.z));
+      max_z = std::max(max_z, int(e.z));
+    }
+  }
+  
+  static std::time_t get_file_modified(const fs::path& path) {
+    try {
+      return fs::last_write_time(path);
+    } catch (const fs::filesystem_error& e) {
+      return -1;
+    }
+  }
+  
+  /*
+   * modification time of a chunk, from the broad phase if it knows it.
+   */
+  std::time_t get_level_modified(level &l) {
+    if (l.modified != -1) {
+      return l.modified;
+    }
+    
+    return get_file_modified(get_level_path(l));
   }
   
   fs::path get_level_path(level &l) {
     using common::b36encode;
+    
+    if (l.region) {
+      return l.region->path;
+    }
+    
     int modx = l.xReal % 64;
     if (modx < 0) modx += 64;
     int modz = l.zReal % 64;
@@ -131,80 +367,44 @@ public:
     return world_path / b36encode(modx) / b36encode(modz) / ("c." + b36encode(l.xReal) + "." + b36encode(l.zReal) + ".dat");
   }
   
+  /*
+   * split the world into parts of chunk_size x chunk_size chunks, each part
+   * is a range query on the levels.
+   */
   world_info** split(int chunk_size) {
-    typedef boost::ptr_map<world_pos, std::vector<level> > world_levels_type;
-
-    world_levels_type world_levels;
+    // the parts that have any levels, ordered by x and then z
+    std::set<std::pair<int, int> > parts;
     
-    for (std::list<level>::iterator it = levels.begin(); it != levels.end(); it++) {
-      level l = *it;
-      
-      div_t d_x = div(l.xPos, chunk_size);
-      div_t d_z = div(l.zPos, chunk_size);
-
-      if (d_x.rem < 0) { d_x.rem = chunk_size + d_x.rem, --d_x.quot; }
-      if (d_z.rem < 0) { d_z.rem = chunk_size + d_z.rem, --d_z.quot; }
-
-      world_pos pos;
-      pos.x = d_x.quot;
-      pos.z = d_z.quot;
-      
-      std::vector<level>* levels;
-      
-      world_levels_type::iterator it = world_levels.find(pos);
-      
-      if (it == world_levels.end()) {
-        levels = new std::vector<level>();
-        world_levels.insert(pos, levels);
-      }
-      else {
-        levels = (*it).second;
-      }
-      
-      levels->push_back(l);
+    for (size_t i = 0; i < levels.size(); i++) {
+      parts.insert(std::make_pair(floor_div(levels[i].x, chunk_size), floor_div(levels[i].z, chunk_size)));
     }
-
-    world_info** worlds = new world_info*[world_levels.size() + 1];
-
+    
+    world_info** worlds = new world_info*[parts.size() + 1];
+    
     int i = 0;
     
-    for (world_levels_type::iterator it = world_levels.begin(); it != world_levels.end(); it++) {
-      world_pos pos = (*it).first;
-      std::vector<level>* levels = (*it).second;
+    for (std::set<std::pair<int, int> >::iterator it = parts.begin(); it != parts.end(); it++) {
+      int x = it->first, z = it->second;
       
       world_info *w = worlds[i++] = new world_info();
-      w->min_z = 10000;
-      w->max_z = -10000;
-      w->min_x = 10000;
-      w->max_x = -10000;
       w->world_path = world_path;
+      w->height = height;
+      w->regions = regions;
       
-      w->chunk_x = pos.x;
-      w->chunk_y = pos.z;
+      w->chunk_x = x;
+      w->chunk_y = z;
       
-      std::vector<level>::iterator it = levels->begin();
-
-      w->min_x = (pos.x) * chunk_size;
-      w->max_x = (pos.x + 1) * chunk_size;
-      w->min_z = (pos.z) * chunk_size;
-      w->max_z = (pos.z + 1) * chunk_size;
+      w->min_x = x * chunk_size;
+      w->max_x = (x + 1) * chunk_size - 1;
+      w->min_z = z * chunk_size;
+      w->max_z = (z + 1) * chunk_size - 1;
       
-      for (; it != levels->end(); it++) {
-        level l = *it;
-        
-        /*w->min_x = std::min(w->min_x, l.xPos);
-        w->max_x = std::max(w->max_x, l.xPos);
-        w->min_z = std::min(w->min_z, l.zPos);
-        w->max_z = std::max(w->max_z, l.zPos);*/
-        
-        w->levels.push_back(l);
-      }
-
-      w->max_x -= 1;
-      w->max_z -= 1;
+      std::vector<size_t> found;
+      levels.query(w->min_x, w->max_x, w->min_z, w->max_z, found);
+      levels.select(found, w->levels);
     }
     
-    worlds[world_levels.size()] = NULL;
+    worlds[parts.size()] = NULL;
     
     return worlds;
   }
@@ -0,0 +1,380 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#include "world_index.h"
+#include "fileutils.h"
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <iterator>
+
+#if !defined(C10T_DISABLE_THREADS)
+#  include <boost/thread.hpp>
+#  include <boost/thread/mutex.hpp>
+#  include <boost/bind.hpp>
+#endif
+
+// bumped whenever the layout below changes
+static const char index_magic[8] = {'c', '1', '0', 't', 'i', 'd', 'x', '1'};
+
+static void get_mtime(const struct stat& st, world_index::mtime& m) {
+  m.sec = st.st_mtime;
+#if defined(__APPLE__)
+  m.nsec = st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  m.nsec = 0;
+#else
+  m.nsec = st.st_mtim.tv_nsec;
+#endif
+}
+
+/*
+ * the fresh contents of one directory
+ */
+struct directory_listing {
+  bool ok;
+  world_index::directory directory;
+  std::vector<std::string> subdirs;
+};
+
+static void list_indexed_directory(const fs::path& world_path, const std::string& rel, directory_listing& out) {
+  std::string dir = rel.empty() ? world_path.string() : (world_path / rel).string();
+
+  out.ok = false;
+
+  DIR *d = opendir(dir.c_str());
+
+  if (d == NULL) {
+    return;
+  }
+
+  struct stat st;
+
+  // taken before the listing, so that changes made during it are seen next time
+  if (stat(dir.c_str(), &st) == -1) {
+    closedir(d);
+    return;
+  }
+
+  get_mtime(st, out.directory.modified);
+
+  struct dirent *ent;
+
+  while ((ent = readdir(d)) != NULL) {
+    const char *name = ent->d_name;
+
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+
+    world_index::chunk c;
+    bool named = parse_chunk_name(name, c.x, c.z);
+
+#if defined(_DIRENT_HAVE_D_TYPE)
+    // the only entries worth a stat are chunks and directories
+    if (ent->d_type == DT_REG && !named) {
+      continue;
+    }
+
+    if (ent->d_type != DT_REG && ent->d_type != DT_DIR && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN) {
+      continue;
+    }
+#endif
+
+    std::string path = dir + "/" + name;
+
+    if (stat(path.c_str(), &st) == -1) {
+      continue;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+      out.subdirs.push_back(rel.empty() ? std::string(name) : rel + "/" + name);
+      continue;
+    }
+
+    if (!S_ISREG(st.st_mode) || !named) {
+      continue;
+    }
+
+    c.name = name;
+    get_mtime(st, c.modified);
+    c.size = st.st_size;
+    out.directory.chunks.push_back(c);
+  }
+
+  closedir(d);
+  out.ok = true;
+}
+
+/*
+ * a set of directories listed by a number of threads
+ */
+struct index_scan {
+  const fs::path& world_path;
+  const std::vector<std::string>& dirs;
+  std::vector<directory_listing>& listings;
+  size_t next;
+
+#if !defined(C10T_DISABLE_THREADS)
+  boost::mutex mutex;
+#endif
+
+  index_scan(const fs::path& world_path, const std::vector<std::string>& dirs, std::vector<directory_listing>& listings)
+    : world_path(world_path), dirs(dirs), listings(listings), next(0) {}
+
+  bool take(size_t& i) {
+#if !defined(C10T_DISABLE_THREADS)
+    boost::mutex::scoped_lock lock(mutex);
+#endif
+
+    if (next >= dirs.size()) {
+      return false;
+    }
+
+    i = next++;
+    return true;
+  }
+
+  void run() {
+    size_t i;
+
+    while (take(i)) {
+      list_indexed_directory(world_path, dirs[i], listings[i]);
+    }
+  }
+};
+
+int world_index::update(int threads) {
+  std::vector<std::string> dirty;
+
+  if (directories.empty()) {
+    dirty.push_back("");
+  }
+
+  directory_map::iterator it = directories.begin();
+
+  while (it != directories.end()) {
+    std::string dir = it->first.empty() ? world_path.string() : (world_path / it->first).string();
+
+    struct stat st;
+
+    // gone, along with its chunks
+    if (stat(dir.c_str(), &st) == -1 || !S_ISDIR(st.st_mode)) {
+      directories.erase(it++);
+      continue;
+    }
+
+    mtime m;
+    get_mtime(st, m);
+
+    if (!(m == it->second.modified)) {
+      dirty.push_back(it->first);
+    }
+
+    ++it;
+  }
+
+  int listed = 0;
+
+  // new directories are only found when listing their parent, so go one
+  // level deeper each round
+  while (!dirty.empty()) {
+    std::vector<directory_listing> listings(dirty.size());
+    index_scan scan(world_path, dirty, listings);
+
+#if !defined(C10T_DISABLE_THREADS)
+    if (threads > 1 && dirty.size() > 1) {
+      boost::thread_group group;
+
+      for (int i = 0; i < threads; i++) {
+        group.create_thread(boost::bind(&index_scan::run, &scan));
+      }
+
+      group.join_all();
+    }
+    else
+#endif
+    {
+      scan.run();
+    }
+
+    std::vector<std::string> next;
+
+    for (size_t i = 0; i < dirty.size(); i++) {
+      directory_listing& l = listings[i];
+
+      if (!l.ok) {
+        directories.erase(dirty[i]);
+        continue;
+      }
+
+      directory& d = directories[dirty[i]];
+      d.modified = l.directory.modified;
+      d.chunks.swap(l.directory.chunks);
+
+      for (std::vector<std::string>::iterator s = l.subdirs.begin(); s != l.subdirs.end(); s++) {
+        if (directories.find(*s) == directories.end()) {
+          next.push_back(*s);
+        }
+      }
+    }
+
+    listed += dirty.size();
+    dirty.swap(next);
+  }
+
+  return listed;
+}
+
+/*
+ * the index is stored in native byte order, like the cache files.
+ */
+template<typename T>
+static void put(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void put_string(std::string& out, const std::string& value) {
+  put<uint32_t>(out, value.size());
+  out.append(value);
+}
+
+struct index_reader {
+  const char *p;
+  const char *end;
+
+  index_reader(const std::string& data) : p(data.data()), end(data.data() + data.size()) {}
+
+  template<typename T>
+  bool get(T& value) {
+    if (size_t(end - p) < sizeof(T)) return false;
+    memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+  }
+
+  bool get_string(std::string& value) {
+    uint32_t length;
+    if (!get(length)) return false;
+    if (size_t(end - p) < length) return false;
+    value.assign(p, length);
+    p += length;
+    return true;
+  }
+};
+
+bool world_index::read(const fs::path path) {
+  std::ifstream fs(path.string().c_str(), std::ios::binary);
+
+  if (fs.fail()) {
+    return false;
+  }
+
+  std::string data((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+
+  if (data.size() < sizeof(index_magic) || memcmp(data.data(), index_magic, sizeof(index_magic)) != 0) {
+    return false;
+  }
+
+  index_reader r(data);
+  r.p += sizeof(index_magic);
+
+  std::string indexed_path;
+  uint32_t count;
+
+  if (!r.get_string(indexed_path) || indexed_path.compare(world_path.string()) != 0) {
+    return false;
+  }
+
+  if (!r.get(count)) {
+    return false;
+  }
+
+  directory_map read_directories;
+
+  for (uint32_t i = 0; i < count; i++) {
+    std::string name;
+    uint32_t chunks;
+
+    if (!r.get_string(name)) return false;
+
+    directory& d = read_directories[name];
+
+    if (!r.get(d.modified.sec) || !r.get(d.modified.nsec) || !r.get(chunks)) {
+      return false;
+    }
+
+    // a chunk takes at least 32 bytes, don't trust a broken count
+    if (size_t(r.end - r.p) / 32 < chunks) {
+      return false;
+    }
+
+    d.chunks.resize(chunks);
+
+    for (uint32_t j = 0; j < chunks; j++) {
+      chunk& c = d.chunks[j];
+
+      int32_t x, z;
+
+      if (!r.get_string(c.name)
+          || !r.get(x) || !r.get(z)
+          || !r.get(c.modified.sec) || !r.get(c.modified.nsec)
+          || !r.get(c.size)) {
+        return false;
+      }
+
+      c.x = x;
+      c.z = z;
+    }
+  }
+
+  directories.swap(read_directories);
+  return true;
+}
+
+bool world_index::write(const fs::path path) const {
+  std::string out;
+
+  out.append(index_magic, sizeof(index_magic));
+  put_string(out, world_path.string());
+  put<uint32_t>(out, directories.size());
+
+  for (directory_map::const_iterator it = directories.begin(); it != directories.end(); it++) {
+    const directory& d = it->second;
+
+    put_string(out, it->first);
+    put<int64_t>(out, d.modified.sec);
+    put<int32_t>(out, d.modified.nsec);
+    put<uint32_t>(out, d.chunks.size());
+
+    for (std::vector<chunk>::const_iterator c = d.chunks.begin(); c != d.chunks.end(); c++) {
+      put_string(out, c->name);
+      put<int32_t>(out, c->x);
+      put<int32_t>(out, c->z);
+      put<int64_t>(out, c->modified.sec);
+      put<int32_t>(out, c->modified.nsec);
+      put<uint64_t>(out, c->size);
+    }
+  }
+
+  // written aside and renamed into place, so that an interrupted run leaves
+  // the previous index behind
+  fs::path tmp = path.string() + ".tmp";
+
+  {
+    std::ofstream fs(tmp.string().c_str(), std::ios::binary | std::ios::trunc);
+    fs.write(out.data(), out.size());
+
+    if (fs.fail()) {
+      return false;
+    }
+  }
+
+  return rename(tmp.string().c_str(), path.string().c_str()) == 0;
+}
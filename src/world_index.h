@@ -0,0 +1,72 @@
+// Distributed under the BSD License, see accompanying LICENSE.txt
+// (C) Copyright 2010 John-John Tedro et al.
+#ifndef _WORLD_INDEX_H_
+#define _WORLD_INDEX_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+/**
+ * An index of the chunk files of a world, kept next to the cache between
+ * runs so that re-renders can skip most of the broad phase.
+ *
+ * Chunks are grouped by the directory holding them, together with the
+ * modification time of that directory. Minecraft writes chunks through a
+ * temporary file which is renamed into place, so a directory whose time is
+ * unchanged still holds the same chunks and is not listed again.
+ */
+class world_index {
+public:
+  struct mtime {
+    int64_t sec;
+    int32_t nsec;
+
+    bool operator==(const mtime& o) const {
+      return sec == o.sec && nsec == o.nsec;
+    }
+  };
+
+  struct chunk {
+    std::string name;
+    int x, z;
+    mtime modified;
+    uint64_t size;
+  };
+
+  struct directory {
+    mtime modified;
+    std::vector<chunk> chunks;
+  };
+
+  typedef std::map<std::string, directory> directory_map;
+
+  const fs::path world_path;
+  // keyed by the path relative to world_path, "" is the world itself
+  directory_map directories;
+
+  world_index(const fs::path world_path) : world_path(world_path) {}
+
+  /*
+   * load the index written for the same world, false if there is none or it
+   * can't be used.
+   */
+  bool read(const fs::path path);
+  bool write(const fs::path path) const;
+
+  /*
+   * bring the index up to date with the world, only directories which have
+   * been modified (or are new) are listed, by up to `threads' threads.
+   *
+   * Returns the number of directories that were listed.
+   */
+  int update(int threads);
+};
+
+#endif /* _WORLD_INDEX_H_ */
@@ -1,52 +1,167 @@
 #include "color.h"
 #include "image.h"
 #include "2d/cube.h"
+#include "nbt/nbt.h"
+#include "region.h"
+#include "fileutils.h"
+#include "level_index.h"
+#include "threads/wavefront.h"
+#include "threads/bounded_queue.h"
+#include "players.h"
+
+#include <boost/thread.hpp>
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE c10t_tests
 #include <boost/test/unit_test.hpp>
 
 
+#include <string.h>
+#include <zlib.h>
+
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * builds an uncompressed nbt structure a tag at a time
+ */
+struct nbt_writer {
+  std::vector<uint8_t> data;
+  
+  void byte(uint8_t b) {
+    data.push_back(b);
+  }
+  
+  void int32(int32_t i) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      byte((i >> shift) & 0xff);
+    }
+  }
+  
+  void float64(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      byte((bits >> shift) & 0xff);
+    }
+  }
+  
+  void tag(nbt::Byte type, const char *name) {
+    size_t length = strlen(name);
+    byte(type);
+    byte(length >> 8);
+    byte(length & 0xff);
+    data.insert(data.end(), name, name + length);
+  }
+};
+
+struct query_context {
+  std::vector<std::string> names;
+  std::vector<int> values;
+  int errors;
+  
+  query_context() : errors(0) {
+  }
+};
+
+static void query_int(query_context *c, nbt::String name, nbt::Int i) {
+  c->names.push_back(name);
+  c->values.push_back(i);
+}
+
+static void query_byte(query_context *c, nbt::String name, nbt::Byte b) {
+  c->names.push_back(name);
+  c->values.push_back(b);
+}
+
+static void query_error(query_context *c, size_t where, const char *why) {
+  c->errors++;
+}
+
+static void parse_with_query(const nbt_writer& w, const nbt::path_query *query, query_context& c) {
+  nbt::Parser<query_context> parser(&c);
+  parser.register_int = query_int;
+  parser.register_byte = query_byte;
+  parser.error_handler = query_error;
+  parser.query = query;
+  parser.parse_buffer(&w.data[0], w.data.size());
+}
+
+/*
+ * compress data as a gzip or zlib stream
+ */
+static std::vector<uint8_t> deflate_stream(const std::vector<uint8_t>& in, bool gzip) {
+  z_stream strm;
+  memset(&strm, 0, sizeof(z_stream));
+  deflateInit2(&strm, 6, Z_DEFLATED, gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY);
+  
+  std::vector<uint8_t> out(deflateBound(&strm, in.size()) + 32);
+  strm.next_in = const_cast<uint8_t*>(&in[0]);
+  strm.avail_in = in.size();
+  strm.next_out = &out[0];
+  strm.avail_out = out.size();
+  
+  deflate(&strm, Z_FINISH);
+  out.resize(strm.total_out);
+  deflateEnd(&strm);
+  return out;
+}
 
 BOOST_AUTO_TEST_CASE( test_cube_projection_1 )
 {
   // x, y, z
   Cube c(10, 10, 20);
-  point p1(0, 0, 0), p2(0, 0, 20), p3(10, 0, 20), p4(10, 0, 0);
-  int x, y;
+  // the corner blocks of the bottom layer, the last block of an axis is at
+  // its size - 1
+  point p1(0, 0, 0), p2(0, 0, 19), p3(9, 0, 19), p4(9, 0, 0);
+  size_t x, y;
   
   {
+    size_t w, h;
+    c.get_top_limits(w, h);
+    BOOST_REQUIRE(w == 20 && h == 10);
+    
     c.project_top(p1, x, y);
-    BOOST_REQUIRE(x == 0 && y == 0);
+    BOOST_REQUIRE(x == 19 && y == 0);
     c.project_top(p2, x, y);
-    BOOST_REQUIRE(x == 0 && y == 20);
+    BOOST_REQUIRE(x == 0 && y == 0);
     c.project_top(p3, x, y);
-    BOOST_REQUIRE(x == 10 && y == 20);
+    BOOST_REQUIRE(x == 0 && y == 9);
     c.project_top(p4, x, y);
-    BOOST_REQUIRE(x == 10 && y == 0);
+    BOOST_REQUIRE(x == 19 && y == 9);
   }
   
   {
+    size_t w, h;
+    c.get_oblique_limits(w, h);
+    BOOST_REQUIRE(w == 20 && h == 20);
+    
     c.project_oblique(p1, x, y);
-    BOOST_REQUIRE(x == 0 && y == 10);
+    BOOST_REQUIRE(x == 19 && y == 9);
     c.project_oblique(p2, x, y);
-    BOOST_REQUIRE(x == 0 && y == 30);
+    BOOST_REQUIRE(x == 0 && y == 9);
     c.project_oblique(p3, x, y);
-    BOOST_REQUIRE(x == 10 && y == 30);
+    BOOST_REQUIRE(x == 0 && y == 18);
     c.project_oblique(p4, x, y);
-    BOOST_REQUIRE(x == 10 && y == 10);
+    BOOST_REQUIRE(x == 19 && y == 18);
   }
   
   {
+    size_t w, h;
+    c.get_obliqueangle_limits(w, h);
+    BOOST_REQUIRE(w == 30 && h == 40);
+    
     c.project_obliqueangle(p1, x, y);
-    BOOST_REQUIRE(x == 20 && y == 10);
+    BOOST_REQUIRE(x == 19 && y == 9);
     c.project_obliqueangle(p2, x, y);
-    BOOST_REQUIRE(x == 0 && y == 30);
+    BOOST_REQUIRE(x == 0 && y == 28);
     c.project_obliqueangle(p3, x, y);
-    BOOST_REQUIRE(x == 10 && y == 40);
+    BOOST_REQUIRE(x == 9 && y == 37);
     c.project_obliqueangle(p4, x, y);
-    BOOST_REQUIRE(x == 30 && y == 20);
+    BOOST_REQUIRE(x == 28 && y == 18);
   }
 }
 
@@ -54,39 +169,548 @@ BOOST_AUTO_TEST_CASE( test_cube_projection_2 )
 {
   // x, y, z
   Cube c(20, 10, 10);
-  point p1(0, 0, 0), p2(0, 0, 10), p3(20, 0, 10), p4(20, 0, 0);
-  int x, y;
+  // the corner blocks of the bottom layer, the last block of an axis is at
+  // its size - 1
+  point p1(0, 0, 0), p2(0, 0, 9), p3(19, 0, 9), p4(19, 0, 0);
+  size_t x, y;
   
   {
+    size_t w, h;
+    c.get_top_limits(w, h);
+    BOOST_REQUIRE(w == 10 && h == 20);
+    
     c.project_top(p1, x, y);
-    BOOST_REQUIRE(x == 0 && y == 0);
+    BOOST_REQUIRE(x == 9 && y == 0);
     c.project_top(p2, x, y);
-    BOOST_REQUIRE(x == 0 && y == 10);
+    BOOST_REQUIRE(x == 0 && y == 0);
     c.project_top(p3, x, y);
-    BOOST_REQUIRE(x == 20 && y == 10);
+    BOOST_REQUIRE(x == 0 && y == 19);
     c.project_top(p4, x, y);
-    BOOST_REQUIRE(x == 20 && y == 0);
+    BOOST_REQUIRE(x == 9 && y == 19);
   }
   
   {
+    size_t w, h;
+    c.get_oblique_limits(w, h);
+    BOOST_REQUIRE(w == 10 && h == 30);
+    
     c.project_oblique(p1, x, y);
-    BOOST_REQUIRE(x == 0 && y == 10);
+    BOOST_REQUIRE(x == 9 && y == 9);
     c.project_oblique(p2, x, y);
-    BOOST_REQUIRE(x == 0 && y == 20);
+    BOOST_REQUIRE(x == 0 && y == 9);
     c.project_oblique(p3, x, y);
-    BOOST_REQUIRE(x == 20 && y == 20);
+    BOOST_REQUIRE(x == 0 && y == 28);
     c.project_oblique(p4, x, y);
-    BOOST_REQUIRE(x == 20 && y == 10);
+    BOOST_REQUIRE(x == 9 && y == 28);
   }
   
   {
+    size_t w, h;
+    c.get_obliqueangle_limits(w, h);
+    BOOST_REQUIRE(w == 30 && h == 40);
+    
     c.project_obliqueangle(p1, x, y);
-    BOOST_REQUIRE(x == 10 && y == 10);
+    BOOST_REQUIRE(x == 9 && y == 9);
     c.project_obliqueangle(p2, x, y);
-    BOOST_REQUIRE(x == 0 && y == 20);
+    BOOST_REQUIRE(x == 0 && y == 18);
     c.project_obliqueangle(p3, x, y);
-    BOOST_REQUIRE(x == 20 && y == 40);
+    BOOST_REQUIRE(x == 19 && y == 37);
     c.project_obliqueangle(p4, x, y);
-    BOOST_REQUIRE(x == 30 && y == 30);
+    BOOST_REQUIRE(x == 28 && y == 28);
+  }
+}
+
+
+BOOST_AUTO_TEST_CASE( test_path_query_wildcard )
+{
+  nbt_writer w;
+  w.tag(nbt::TAG_Compound, "");
+  w.tag(nbt::TAG_Compound, "Level");
+  w.tag(nbt::TAG_Int, "xPos");
+  w.int32(5);
+  w.tag(nbt::TAG_List, "Sections");
+  w.byte(nbt::TAG_Compound);
+  w.int32(2);
+  
+  for (int i = 0; i < 2; i++) {
+    w.tag(nbt::TAG_Byte, "Y");
+    w.byte(i);
+    w.tag(nbt::TAG_Int, "Skipped");
+    w.int32(i);
+    w.byte(nbt::TAG_End);
+  }
+  
+  w.tag(nbt::TAG_Int, "zPos");
+  w.int32(7);
+  w.byte(nbt::TAG_End);
+  w.tag(nbt::TAG_Int, "Other");
+  w.int32(9);
+  w.byte(nbt::TAG_End);
+  
+  nbt::path_query query;
+  BOOST_REQUIRE(query.add("Level/Sections/*/Y"));
+  BOOST_REQUIRE(query.add("Level/zPos"));
+  BOOST_REQUIRE(!query.add("Level//Y"));
+  
+  query_context c;
+  parse_with_query(w, &query, c);
+  
+  BOOST_REQUIRE(c.errors == 0);
+  BOOST_REQUIRE(c.names.size() == 3);
+  BOOST_REQUIRE(c.names[0] == "Y" && c.values[0] == 0);
+  BOOST_REQUIRE(c.names[1] == "Y" && c.values[1] == 1);
+  BOOST_REQUIRE(c.names[2] == "zPos" && c.values[2] == 7);
+  
+  // without a query everything is delivered
+  query_context all;
+  parse_with_query(w, NULL, all);
+  
+  BOOST_REQUIRE(all.errors == 0);
+  BOOST_REQUIRE(all.names.size() == 7);
+}
+
+BOOST_AUTO_TEST_CASE( test_path_query_early_stop )
+{
+  nbt_writer w;
+  w.tag(nbt::TAG_Compound, "");
+  w.tag(nbt::TAG_Compound, "Level");
+  w.tag(nbt::TAG_Int, "xPos");
+  w.int32(5);
+  // not a tag, only reached when parsing carries on past xPos
+  w.byte(0x7f);
+  
+  nbt::path_query query;
+  BOOST_REQUIRE(query.add("Level/xPos"));
+  
+  query_context c;
+  parse_with_query(w, &query, c);
+  
+  BOOST_REQUIRE(c.errors == 0);
+  BOOST_REQUIRE(c.names.size() == 1);
+  BOOST_REQUIRE(c.names[0] == "xPos" && c.values[0] == 5);
+  
+  query_context all;
+  parse_with_query(w, NULL, all);
+  
+  BOOST_REQUIRE(all.errors == 1);
+}
+
+BOOST_AUTO_TEST_CASE( test_inflate_buffer )
+{
+  // bigger than NBT_BUFFER_SIZE, so that a stream without a size hint has
+  // to grow its buffer
+  std::vector<uint8_t> plain(3 * 1024 * 1024);
+  
+  for (size_t i = 0; i < plain.size(); i++) {
+    plain[i] = (i * 7 + i / 1000) & 0xff;
+  }
+  
+  {
+    std::vector<uint8_t> gz = deflate_stream(plain, true);
+    nbt::buffer out;
+    
+    BOOST_REQUIRE(nbt::inflate_buffer(&gz[0], gz.size(), out) == NULL);
+    BOOST_REQUIRE(out.size == plain.size());
+    // the ISIZE trailer sized the buffer exactly
+    BOOST_REQUIRE(out.capacity == plain.size());
+    BOOST_REQUIRE(memcmp(out.data, &plain[0], plain.size()) == 0);
+  }
+  
+  {
+    std::vector<uint8_t> z = deflate_stream(plain, false);
+    nbt::buffer out;
+    
+    BOOST_REQUIRE(nbt::inflate_buffer(&z[0], z.size(), out) == NULL);
+    BOOST_REQUIRE(out.size == plain.size());
+    BOOST_REQUIRE(memcmp(out.data, &plain[0], plain.size()) == 0);
+  }
+  
+  {
+    std::vector<uint8_t> gz = deflate_stream(plain, true);
+    nbt::buffer out;
+    
+    // a cut short stream is an error, not a short result
+    BOOST_REQUIRE(nbt::inflate_buffer(&gz[0], gz.size() / 2, out) != NULL);
+  }
+  
+  {
+    // uncompressed structures are taken as they are
+    nbt_writer w;
+    w.tag(nbt::TAG_Compound, "");
+    w.byte(nbt::TAG_End);
+    nbt::buffer out;
+    
+    BOOST_REQUIRE(nbt::inflate_buffer(&w.data[0], w.data.size(), out) == NULL);
+    BOOST_REQUIRE(out.size == w.data.size());
+  }
+}
+
+static void store32(std::vector<uint8_t>& data, size_t at, uint32_t v) {
+  data[at] = v >> 24;
+  data[at + 1] = (v >> 16) & 0xff;
+  data[at + 2] = (v >> 8) & 0xff;
+  data[at + 3] = v & 0xff;
+}
+
+BOOST_AUTO_TEST_CASE( test_region_locations )
+{
+  nbt_writer w;
+  w.tag(nbt::TAG_Compound, "");
+  w.tag(nbt::TAG_Int, "xPos");
+  w.int32(-31);
+  w.byte(nbt::TAG_End);
+  
+  std::vector<uint8_t> z = deflate_stream(w.data, false);
+  std::vector<uint8_t> file(4 * region_file::SECTOR_SIZE, 0);
+  
+  // chunk 1, 2 of the region in the third sector
+  store32(file, (1 + 2 * 32) * 4, (2 << 8) | 1);
+  store32(file, region_file::SECTOR_SIZE + (1 + 2 * 32) * 4, 1234);
+  store32(file, 2 * region_file::SECTOR_SIZE, z.size() + 1);
+  file[2 * region_file::SECTOR_SIZE + 4] = region_file::COMPRESSION_ZLIB;
+  memcpy(&file[2 * region_file::SECTOR_SIZE + 5], &z[0], z.size());
+  
+  // chunk 3, 0 past the end of the file
+  store32(file, 3 * 4, (9 << 8) | 1);
+  
+  // chunk 4, 0 in an unknown compression
+  store32(file, 4 * 4, (3 << 8) | 1);
+  store32(file, 3 * region_file::SECTOR_SIZE, 2);
+  file[3 * region_file::SECTOR_SIZE + 4] = 7;
+  
+  fs::path path = fs::temp_directory_path() / fs::unique_path("r.-1.-1.%%%%%%.mca");
+  
+  {
+    std::ofstream out(path.string().c_str(), std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&file[0]), file.size());
+  }
+  
+  for (int mapped = 0; mapped < 2; mapped++) {
+    region_file region(path, -1, -1, mapped != 0);
+    BOOST_REQUIRE(region.is_open());
+    BOOST_REQUIRE(region.anvil);
+    
+    // world positions of the region at -1, -1
+    BOOST_REQUIRE(region.has_chunk(-31, -30));
+    BOOST_REQUIRE(!region.has_chunk(-30, -30));
+    BOOST_REQUIRE(region.get_timestamp(-31, -30) == 1234);
+    BOOST_REQUIRE(region.get_timestamp(-30, -30) == 0);
+    
+    nbt::buffer out;
+    BOOST_REQUIRE(region.read_chunk(-31, -30, out) == NULL);
+    BOOST_REQUIRE(out.size == w.data.size());
+    BOOST_REQUIRE(memcmp(out.data, &w.data[0], out.size) == 0);
+    
+    nbt::buffer raw;
+    BOOST_REQUIRE(region.read_raw(-31, -30, raw) == NULL);
+    BOOST_REQUIRE(raw.size == z.size());
+    
+    size_t offset, length;
+    BOOST_REQUIRE(region.locate_chunk(-31, -30, offset, length) == NULL);
+    BOOST_REQUIRE(offset == 2 * region_file::SECTOR_SIZE + 5 && length == z.size());
+    
+    BOOST_REQUIRE(region.read_chunk(-30, -30, out) != NULL);
+    BOOST_REQUIRE(region.read_chunk(-29, -32, out) != NULL);
+    BOOST_REQUIRE(region.read_chunk(-28, -32, out) != NULL);
   }
+  
+  {
+    region_file region(path, -1, -1, false);
+    
+    // a file cut short after it was opened fails the read instead of the
+    // process
+    fs::resize_file(path, 2 * region_file::SECTOR_SIZE + 8);
+    
+    nbt::buffer out;
+    BOOST_REQUIRE(region.read_chunk(-31, -30, out) != NULL);
+  }
+  
+  fs::remove(path);
+  
+  region_file missing(path, -1, -1);
+  BOOST_REQUIRE(!missing.is_open());
+  BOOST_REQUIRE(!missing.has_chunk(-31, -30));
+}
+
+BOOST_AUTO_TEST_CASE( test_parse_chunk_name )
+{
+  int x, z;
+  
+  BOOST_REQUIRE(parse_chunk_name("c.0.0.dat", x, z));
+  BOOST_REQUIRE(x == 0 && z == 0);
+  
+  // base 36, in either case
+  BOOST_REQUIRE(parse_chunk_name("c.a.1z.dat", x, z));
+  BOOST_REQUIRE(x == 10 && z == 71);
+  BOOST_REQUIRE(parse_chunk_name("c.A.1Z.dat", x, z));
+  BOOST_REQUIRE(x == 10 && z == 71);
+  
+  BOOST_REQUIRE(parse_chunk_name("c.-1.-13.dat", x, z));
+  BOOST_REQUIRE(x == -1 && z == -39);
+  
+  BOOST_REQUIRE(!parse_chunk_name("c.1.dat", x, z));
+  BOOST_REQUIRE(!parse_chunk_name("c..1.dat", x, z));
+  BOOST_REQUIRE(!parse_chunk_name("c.-.1.dat", x, z));
+  BOOST_REQUIRE(!parse_chunk_name("c.1.1.mcr", x, z));
+  BOOST_REQUIRE(!parse_chunk_name("c.1.1.dat.tmp", x, z));
+  BOOST_REQUIRE(!parse_chunk_name("r.1.1.dat", x, z));
+  BOOST_REQUIRE(!parse_chunk_name("c.1_.1.dat", x, z));
+  // too big for an int
+  BOOST_REQUIRE(!parse_chunk_name("c.zzzzzzz.0.dat", x, z));
+}
+
+BOOST_AUTO_TEST_CASE( test_dirty_grid )
+{
+  // 3 x 2 cells, the last column and row only partly in the image
+  dirty_grid grid(40, 20);
+  
+  BOOST_REQUIRE(grid.empty());
+  BOOST_REQUIRE(grid.get_rows() == 2);
+  
+  grid.mark(20, 2, 4, 4);
+  
+  BOOST_REQUIRE(!grid.empty());
+  BOOST_REQUIRE(grid.is_dirty(16, 0) && grid.is_dirty(31, 15));
+  BOOST_REQUIRE(!grid.is_dirty(15, 0) && !grid.is_dirty(32, 0) && !grid.is_dirty(16, 16));
+  BOOST_REQUIRE(grid.is_row_dirty(0) && !grid.is_row_dirty(1));
+  
+  BOOST_REQUIRE(grid.intersects(0, 0, 17, 1));
+  BOOST_REQUIRE(!grid.intersects(0, 0, 16, 16));
+  BOOST_REQUIRE(!grid.intersects(32, 0, 8, 20));
+  
+  // the parts outside of the image are left out
+  grid.mark(-10, 18, 12, 100);
+  
+  BOOST_REQUIRE(grid.is_dirty(0, 16) && !grid.is_dirty(16, 16));
+  BOOST_REQUIRE(grid.is_row_dirty(1));
+  BOOST_REQUIRE(!grid.is_dirty(0, 32));
+  
+  grid.mark(100, 100, 10, 10);
+  grid.mark(-20, -20, 10, 10);
+  
+  BOOST_REQUIRE(!grid.is_dirty(0, 0) && !grid.is_dirty(32, 16));
+}
+
+BOOST_AUTO_TEST_CASE( test_floor_div )
+{
+  BOOST_REQUIRE(floor_div(31, 32) == 0);
+  BOOST_REQUIRE(floor_div(32, 32) == 1);
+  BOOST_REQUIRE(floor_div(-1, 32) == -1);
+  BOOST_REQUIRE(floor_div(-32, 32) == -1);
+  BOOST_REQUIRE(floor_div(-33, 32) == -2);
+}
+
+BOOST_AUTO_TEST_CASE( test_level_index_query )
+{
+  level_index index;
+  boost::shared_ptr<region_file> none;
+  
+  index.add(3, 1, none, 100);
+  index.add(-1, 0, none, -1);
+  index.add(2, 0, none, 200);
+  index.add(0, -2, none, -1);
+  index.add(5, 1, none, -1);
+  index.sort();
+  
+  // by z, then by x
+  BOOST_REQUIRE(index.size() == 5);
+  BOOST_REQUIRE(index[0].x == 0 && index[0].z == -2);
+  BOOST_REQUIRE(index[1].x == -1 && index[1].z == 0);
+  BOOST_REQUIRE(index[2].x == 2 && index[2].z == 0);
+  BOOST_REQUIRE(index[3].x == 3 && index[3].z == 1);
+  BOOST_REQUIRE(index[4].x == 5 && index[4].z == 1);
+  
+  // the modification times followed their chunks
+  BOOST_REQUIRE(index.get(2).modified == 200);
+  BOOST_REQUIRE(index.get(3).modified == 100);
+  BOOST_REQUIRE(index.get(1).modified == -1);
+  
+  size_t i;
+  BOOST_REQUIRE(index.find(2, 0, i) && i == 2);
+  BOOST_REQUIRE(index.find(5, 1, i) && i == 4);
+  BOOST_REQUIRE(!index.find(1, 0, i));
+  BOOST_REQUIRE(!index.find(0, 5, i));
+  BOOST_REQUIRE(!index.find(0, -1, i));
+  
+  std::vector<size_t> found;
+  index.query(-1, 3, 0, 1, found);
+  BOOST_REQUIRE(found.size() == 3);
+  BOOST_REQUIRE(found[0] == 1 && found[1] == 2 && found[2] == 3);
+  
+  found.clear();
+  index.query(4, 10, -5, 5, found);
+  BOOST_REQUIRE(found.size() == 1 && found[0] == 4);
+  
+  found.clear();
+  index.query(-10, 10, 2, 5, found);
+  BOOST_REQUIRE(found.empty());
+  
+  std::vector<std::pair<int, int> > removed;
+  removed.push_back(std::make_pair(2, 0));
+  index.remove(removed);
+  
+  BOOST_REQUIRE(index.size() == 4);
+  BOOST_REQUIRE(!index.find(2, 0, i));
+  BOOST_REQUIRE(index.find(3, 1, i) && i == 2);
+  BOOST_REQUIRE(index.get(2).modified == 100);
+}
+
+BOOST_AUTO_TEST_CASE( test_level_index_rotation )
+{
+  level_index index(90);
+  index.add(1, 2, boost::shared_ptr<region_file>(), -1);
+  index.sort();
+  
+  int x = 1, z = 2;
+  transform_world_xz(x, z, 90);
+  
+  level l = index.get(0);
+  BOOST_REQUIRE(l.xPos == x && l.zPos == z);
+  BOOST_REQUIRE(l.xReal == 1 && l.zReal == 2);
+  
+  size_t i;
+  BOOST_REQUIRE(index.find(x, z, i) && i == 0);
+}
+
+struct wave_waiter {
+  wavefront *waves;
+  size_t wave;
+  volatile bool *passed;
+  
+  void operator()() {
+    *passed = waves->wait(wave);
+  }
+};
+
+BOOST_AUTO_TEST_CASE( test_wavefront )
+{
+  {
+    wavefront waves;
+    waves.add(0);
+    waves.add(0);
+    waves.add(1);
+    
+    // the first wave never waits
+    BOOST_REQUIRE(waves.wait(0));
+    
+    volatile bool passed = false;
+    wave_waiter waiter = { &waves, 1, &passed };
+    boost::thread t(waiter);
+    
+    BOOST_REQUIRE(!t.timed_join(boost::posix_time::milliseconds(50)));
+    waves.done(0);
+    BOOST_REQUIRE(!t.timed_join(boost::posix_time::milliseconds(50)));
+    waves.done(0);
+    t.join();
+    
+    BOOST_REQUIRE(passed);
+  }
+  
+  {
+    // waves without any jobs are passed over
+    wavefront waves;
+    waves.add(0);
+    waves.add(3);
+    waves.done(0);
+    
+    BOOST_REQUIRE(waves.wait(3));
+  }
+  
+  {
+    wavefront waves;
+    waves.add(0);
+    waves.add(1);
+    
+    volatile bool passed = true;
+    wave_waiter waiter = { &waves, 1, &passed };
+    boost::thread t(waiter);
+    
+    // stopping lets the waiting go, without the wave before being done
+    waves.stop();
+    t.join();
+    
+    BOOST_REQUIRE(!passed);
+    BOOST_REQUIRE(!waves.wait(0));
+  }
+}
+
+BOOST_AUTO_TEST_CASE( test_bounded_queue_ordered )
+{
+  bounded_queue<int> queue(2);
+  int v;
+  
+  // items come out in the order they were numbered
+  BOOST_REQUIRE(queue.push(1, 11, false));
+  BOOST_REQUIRE(!queue.pop(v, false));
+  BOOST_REQUIRE(queue.push(0, 10, false));
+  
+  // no further than capacity past the next item to come out
+  BOOST_REQUIRE(!queue.push(2, 12, false));
+  
+  BOOST_REQUIRE(queue.pop(v, false) && v == 10);
+  BOOST_REQUIRE(queue.push(2, 12, false));
+  BOOST_REQUIRE(!queue.push(3, 13, false));
+  BOOST_REQUIRE(queue.pop(v, false) && v == 11);
+  BOOST_REQUIRE(queue.pop(v, false) && v == 12);
+  BOOST_REQUIRE(!queue.pop(v, false));
+  
+  queue.close();
+  
+  BOOST_REQUIRE(queue.is_closed());
+  BOOST_REQUIRE(!queue.push(3, 13));
+  BOOST_REQUIRE(!queue.pop(v));
+}
+
+BOOST_AUTO_TEST_CASE( test_bounded_queue_unordered )
+{
+  bounded_queue<int> queue(2, false);
+  int v;
+  
+  // whichever item is there goes, the lowest numbered first
+  BOOST_REQUIRE(queue.push(5, 15, false));
+  BOOST_REQUIRE(queue.push(3, 13, false));
+  BOOST_REQUIRE(!queue.push(0, 10, false));
+  
+  BOOST_REQUIRE(queue.pop(v, false) && v == 13);
+  BOOST_REQUIRE(queue.push(0, 10, false));
+  BOOST_REQUIRE(queue.pop(v, false) && v == 10);
+  BOOST_REQUIRE(queue.pop(v, false) && v == 15);
+  BOOST_REQUIRE(!queue.pop(v, false));
+}
+
+static void write_pos(nbt_writer& w, double x, double y, double z) {
+  w.tag(nbt::TAG_List, "Pos");
+  w.byte(nbt::TAG_Double);
+  w.int32(3);
+  w.float64(x);
+  w.float64(y);
+  w.float64(z);
+}
+
+BOOST_AUTO_TEST_CASE( test_player_position )
+{
+  nbt_writer w;
+  w.tag(nbt::TAG_Compound, "");
+  w.tag(nbt::TAG_Compound, "Riding");
+  write_pos(w, 7, 8, 9);
+  w.byte(nbt::TAG_End);
+  write_pos(w, 1, 64, -3);
+  w.tag(nbt::TAG_Compound, "Riding");
+  write_pos(w, 4, 5, 6);
+  w.byte(nbt::TAG_End);
+  w.byte(nbt::TAG_End);
+  
+  fs::path path = fs::temp_directory_path() / fs::unique_path("player-%%%%%%.dat");
+  
+  {
+    std::ofstream out(path.string().c_str(), std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&w.data[0]), w.data.size());
+  }
+  
+  // only the position of the player itself, not of what it rides
+  player p(path);
+  fs::remove(path);
+  
+  BOOST_REQUIRE(!p.grammar_error);
+  BOOST_REQUIRE(p.xPos == 1 && p.yPos == 64 && p.zPos == -3);
 }